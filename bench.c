@@ -0,0 +1,1494 @@
+// bench -> drives the editor's hot paths without a terminal
+// build with `make bench`, run ./bench [-o results.tsv] [-c baseline.tsv] [-r keylog] [save MB]
+//
+// -o writes every number in the tables as a tab separated record, and -c compares this run
+// against records written by another, so a change can be checked across commits. -r replays
+// keys recorded with `text-editor -r keylog` instead of the generated session
+
+#define EDITOR_NO_MAIN
+#include "text-editor.c"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// the malloc family is wrapped at link time (see the bench target) so frames can count allocations
+unsigned long long benchAllocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    benchAllocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    benchAllocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    benchAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+long long benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// where records go, -1 when they are not wanted. written straight to the fd without stdio, so
+// the benches that run in children can record too
+int benchOut = -1;
+
+// one number of a table: bench, the row it is on, the column, the value
+void benchRecord(const char *bench, const char *what, const char *metric, double value) {
+    if (benchOut != -1) {
+        dprintf(benchOut, "%s\t%s\t%s\t%.6g\n", bench, what, metric, value);
+    }
+}
+
+int benchCompareSamples(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile of samples sorted ascending
+long long benchPercentile(long long *sorted, int n, double p) {
+    int k = (int) (p / 100 * n + 0.5);
+    return sorted[k < 1 ? 0 : (k > n ? n - 1 : k - 1)];
+}
+
+// sort the samples, print p50/p90/p99/max in microseconds and record them
+void benchLatencies(const char *bench, const char *what, long long *samples, int n) {
+    qsort(samples, n, sizeof(long long), benchCompareSamples);
+    double p50 = benchPercentile(samples, n, 50) / 1e3;
+    double p90 = benchPercentile(samples, n, 90) / 1e3;
+    double p99 = benchPercentile(samples, n, 99) / 1e3;
+    double max = samples[n - 1] / 1e3;
+    printf("%-10.1f %-10.1f %-10.1f %-10.1f", p50, p90, p99, max);
+    benchRecord(bench, what, "p50 us", p50);
+    benchRecord(bench, what, "p90 us", p90);
+    benchRecord(bench, what, "p99 us", p99);
+    benchRecord(bench, what, "max us", max);
+}
+
+void benchFillRows(int numrows) {
+    editorFreeRows();
+    char line[64];
+    for (int j = 0; j < numrows; j++) {
+        int len = snprintf(line, sizeof(line), "line %d of the benchmark buffer\tend", j);
+        editorAppendRow(B->numrows, line, len);
+    }
+}
+
+// Enter then Backspace near the top of the file: a row split and a row join per pair
+void benchKeystrokes() {
+    int sizes[] = { 10000, 100000, 1000000 };
+    int pairs = 20000;
+
+    printf("%-12s %-14s %-14s\n", "rows", "ns/enter+bs", "ns/char+bs");
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        benchFillRows(sizes[s]);
+
+        B->coordY = 10;
+        B->coordX = 5;
+        long long start = benchNow();
+        for (int j = 0; j < pairs; j++) {
+            editorInsertNewline();
+            editorDeleteChar();
+        }
+        long long split = (benchNow() - start) / pairs;
+
+        start = benchNow();
+        for (int j = 0; j < pairs; j++) {
+            editorInsertChar('x');
+            editorDeleteChar();
+        }
+        long long typed = (benchNow() - start) / pairs;
+
+        printf("%-12d %-14lld %-14lld\n", sizes[s], split, typed);
+        char what[32];
+        snprintf(what, sizeof(what), "%d rows", sizes[s]);
+        benchRecord("keystrokes", what, "ns/enter+bs", split);
+        benchRecord("keystrokes", what, "ns/char+bs", typed);
+    }
+    editorFreeRows();
+}
+
+// style every row of a synthetic C file, the way the first screenfuls of a scroll would
+void benchHighlight() {
+    const char *corpus[] = {
+        "static int parse_header(struct header *h, const char *buf, size_t len) {",
+        "    for (unsigned int i = 0; i < len; i++) { // walk the buffer",
+        "        if (buf[i] == '\\n' && h->count < 32) return -1;",
+        "    char *name = \"content-length\"; /* default */",
+        "    while (h->next != NULL) { h = h->next; continue; }",
+        "    switch (h->kind) { case 1: break; default: return 0x1f; }",
+        "    double ratio = 3.14159 * (float) h->size / 2.0;",
+        "}",
+    };
+    int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+    int numrows = 500000;
+
+    editorFreeRows();
+    for (int j = 0; j < numrows; j++) {
+        const char *line = corpus[j % ncorpus];
+        editorAppendRow(B->numrows, (char *) line, strlen(line));
+    }
+    B->filename = "bench.c";
+    editorSelectSyntaxHighlight();
+
+    long long bytes = 0;
+    long long start = benchNow();
+    for (int j = 0; j < numrows; j++) {
+        struct rowRender *rr = editorRowRender(j);
+        bytes += rr->renderSize;
+    }
+    long long elapsed = benchNow() - start;
+
+    printf("%-12s %-14s %-14s\n", "rows", "ns/row", "MB/s");
+    printf("%-12d %-14lld %-14.1f\n", numrows, elapsed / numrows, bytes / (elapsed / 1e9) / 1e6);
+    benchRecord("highlight", "style", "ns/row", elapsed / numrows);
+    benchRecord("highlight", "style", "MB/s", bytes / (elapsed / 1e9) / 1e6);
+
+    B->syntax = NULL;
+    B->filename = NULL;
+    editorFreeRows();
+}
+
+// the comment state pass over a freshly loaded 1M-row file: the frontier walked serially, then
+// editorSyntaxScan on more and more threads, checked against the serial states
+void benchHighlightScan() {
+    const char *corpus[] = {
+        "/* a block comment",
+        " * that runs over lines \"with a quote",
+        " */",
+        "static int parse_header(struct header *h, const char *buf, size_t len) {",
+        "    char *name = \"content-length /* not a comment\"; // nor /* this",
+        "    return h->count; /* closed */ }",
+        "    /* left open",
+        "    */ int tail = 0x1f;",
+    };
+    int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+    int numrows = 1000000;
+
+    editorFreeRows();
+    for (int j = 0; j < numrows; j++) {
+        const char *line = corpus[(j * 7 / 3) % ncorpus];
+        editorAppendRow(B->numrows, (char *) line, strlen(line));
+    }
+    B->filename = "bench.c";
+    editorSelectSyntaxHighlight();
+
+    long long start = benchNow();
+    editorSyntaxCatchUp(numrows);
+    long long serial = benchNow() - start;
+    unsigned char *want = malloc(numrows);
+    for (int j = 0; j < numrows; j++) {
+        want[j] = editorRowAt(j)->hl_open_comment;
+    }
+
+    // past the CPU count the speedup stops, but the fixup still has to come out right
+    printf("%-12s %-14s %-14s %-10s (%ld cpus)\n", "threads", "ms", "speedup", "states",
+            sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-12s %-14.2f %-14.2f %-10s\n", "frontier", serial / 1e6, 1.0, "ok");
+    benchRecord("highlight scan", "frontier", "ms", serial / 1e6);
+    for (int t = 1; t <= LOAD_MAX_THREADS; t *= 2) {
+        for (int j = 0; j < numrows; j++) {
+            editorRowAt(j)->hl_open_comment = 0;
+        }
+        start = benchNow();
+        editorSyntaxScan(t);
+        long long elapsed = benchNow() - start;
+        int same = 1;
+        for (int j = 0; j < numrows && same; j++) {
+            same = editorRowAt(j)->hl_open_comment == want[j];
+        }
+        printf("%-12d %-14.2f %-14.2f %-10s\n", t, elapsed / 1e6, (double) serial / elapsed, same ? "ok" : "WRONG");
+        char what[32];
+        snprintf(what, sizeof(what), "%d threads", t);
+        benchRecord("highlight scan", what, "ms", elapsed / 1e6);
+    }
+
+    free(want);
+    B->syntax = NULL;
+    B->filename = NULL;
+    editorFreeRows();
+}
+
+// a directory of 64 definition files of 120 keywords each: compiled and written to the cache,
+// then mapped back from it, then file names looked up in its hash the way every open does
+void benchSyntax() {
+    char dir[] = "/tmp/bench-syntax.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("syntax: can't create %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    int nfiles = 64, nkeywords = 120;
+    char path[PATH_MAX];
+    for (int j = 0; j < nfiles; j++) {
+        snprintf(path, sizeof(path), "%s/lang%02d%s", dir, j, SYNTAX_SUFFIX);
+        FILE *fp = fopen(path, "w");
+        fprintf(fp, "# generated\nfiletype lang%d\nmatch .l%d .lang%d Langfile%d\nkeywords", j, j, j, j);
+        for (int k = 0; k < nkeywords; k++) {
+            fprintf(fp, " kw%c%c%d", 'a' + k % 26, 'a' + (j + k) % 26, k);
+        }
+        fprintf(fp, "\ntypes t%d_int t%d_str\ncomment //\nblock /* */\nhighlight numbers strings\n", j, j);
+        fclose(fp);
+    }
+
+    char msg[256];
+    B->syntax = NULL;
+    long long start = benchNow();
+    int ok = editorSyntaxLoad(dir, msg, sizeof(msg)) == 0;
+    long long compiled = benchNow() - start;
+    int size = E.syntax.size;
+
+    int loads = 200;
+    start = benchNow();
+    for (int j = 0; j < loads; j++) {
+        ok &= editorSyntaxLoad(dir, msg, sizeof(msg)) == 0 && E.syntax.mapped;
+    }
+    long long mapped = (benchNow() - start) / loads;
+
+    // hits by extension and by whole name, and misses that fall through both
+    const char *names[] = { "src/main.l7", "x.lang40", "Langfile63", "notes.txt", "README" };
+    int nnames = sizeof(names) / sizeof(names[0]);
+    int lookups = 1000000;
+    char *filename = B->filename;
+    start = benchNow();
+    for (int j = 0; j < lookups; j++) {
+        B->filename = (char *) names[j % nnames];
+        editorSelectSyntaxHighlight();
+        ok &= (B->syntax != NULL) == (j % nnames < 3);
+    }
+    long long selected = benchNow() - start;
+    B->filename = filename;
+
+    printf("%-12s %-10s %-14s %-14s %-14s %-6s\n", "definitions", "cache KB", "compile ms", "mapped ms",
+            "ns/select", "ok");
+    printf("%-12d %-10d %-14.2f %-14.3f %-14lld %-6s\n", nfiles + (int) HL_DB_ENTRIES, size / 1024,
+            compiled / 1e6, mapped / 1e6, selected / lookups, ok ? "ok" : "WRONG");
+    benchRecord("syntax", "load", "compile ms", compiled / 1e6);
+    benchRecord("syntax", "load", "mapped ms", mapped / 1e6);
+    benchRecord("syntax", "select", "ns/select", selected / lookups);
+
+    // back to the built-in definitions for the benches after
+    B->syntax = NULL;
+    editorSyntaxLoad(NULL, msg, sizeof(msg));
+    for (int j = 0; j < nfiles; j++) {
+        snprintf(path, sizeof(path), "%s/lang%02d%s", dir, j, SYNTAX_SUFFIX);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, SYNTAX_CACHE);
+    unlink(path);
+    rmdir(dir);
+}
+
+// screen column of the cursor at the end of a 1 MB line of mixed ASCII, accented, wide and tab
+// glyphs: the row mapped once, then looked up through its chunk map, against a walk of the
+// row from its start as each frame used to do
+void benchColumns() {
+    const char *piece = "int x = 1;\tcaf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac e\xcc\x81 ";
+    int plen = strlen(piece);
+    int size = 1024 * 1024 / plen * plen;
+    char *line = malloc(size);
+    for (int j = 0; j < size; j += plen) {
+        memcpy(&line[j], piece, plen);
+    }
+    editorFreeRows();
+    editorAppendRow(0, line, size);
+    free(line);
+
+    long long start = benchNow();
+    editorRowRender(0);
+    long long buildNs = benchNow() - start;
+
+    int lookups = 100000;
+    start = benchNow();
+    for (int j = 0; j < lookups; j++) {
+        editorRowCoordXtoRenderX(0, size - (j & 63));
+    }
+    long long mapNs = (benchNow() - start) / lookups;
+    int walks = 20, columns = 0;
+    start = benchNow();
+    for (int j = 0; j < walks; j++) {
+        struct columnMark m = { 0, 0, 0 };
+        while (editorRowStep(editorRowAt(0), &m)) {
+        }
+        columns = m.column;
+    }
+    long long walkNs = (benchNow() - start) / walks;
+
+    printf("%-12s %-14s %-14s %-14s %-14s\n", "bytes", "columns", "ms/build", "ns/lookup", "ns/walk");
+    printf("%-12d %-14d %-14.1f %-14lld %-14lld\n", size, columns, buildNs / 1e6, mapNs, walkNs);
+    benchRecord("columns", "1 MB line", "ms/build", buildNs / 1e6);
+    benchRecord("columns", "1 MB line", "ns/lookup", mapNs);
+    benchRecord("columns", "1 MB line", "ns/walk", walkNs);
+    editorFreeRows();
+}
+
+// a 16 MB minified line, plain and styled as C: the first frame, a jump to its end, then a
+// frame per character typed at its end and in its middle. a long row renders only the chunks
+// around the screen and an edit restyles only the chunk it touched, but a middle insert still
+// moves the 8 MB after it, most of what that case measures
+void benchLongLine() {
+    const char *piece = "{\"id\":1234,\"name\":\"caf\xc3\xa9\\t\xe6\x97\xa5\",\"tags\":[1,2.5,null]},";
+    int plen = strlen(piece);
+    int size = 16 * 1024 * 1024 / plen * plen;
+    char *line = malloc(size);
+    for (int j = 0; j < size; j += plen) {
+        memcpy(&line[j], piece, plen);
+    }
+    const char *names[] = { "plain", "c" };
+    int keys = 500;
+    long long opened[2], ended[2];
+    long long *samples[2][2];
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    for (int c = 0; c < 2; c++) {
+        long long start = benchNow();
+        editorFreeRows();
+        editorAppendRow(0, line, size);
+        B->filename = c ? "min.c" : NULL;
+        editorSelectSyntaxHighlight();
+        B->coordY = B->coordX = 0;
+        B->rowOffset = B->colOffset = 0;
+        E.frameValid = 0;
+        editorRefreshScreen();
+        opened[c] = benchNow() - start;
+
+        start = benchNow();
+        B->coordX = editorRowAt(0)->size;
+        editorRefreshScreen();
+        ended[c] = benchNow() - start;
+
+        for (int at = 0; at < 2; at++) {
+            B->coordX = at ? editorRowAt(0)->size / 2 : editorRowAt(0)->size;
+            editorRefreshScreen();
+            samples[c][at] = malloc(sizeof(long long) * keys);
+            for (int j = 0; j < keys; j++) {
+                start = benchNow();
+                editorInsertChar('x');
+                editorRefreshScreen();
+                samples[c][at][j] = benchNow() - start;
+            }
+        }
+    }
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devnull);
+
+    printf("%-14s %-10s %-10s %-10s %-10s %-10s %-10s\n", "16 MB line", "open ms", "end ms", "p50 us", "p90 us",
+            "p99 us", "max us");
+    for (int c = 0; c < 2; c++) {
+        for (int at = 0; at < 2; at++) {
+            char what[32];
+            snprintf(what, sizeof(what), "%s, %s", names[c], at ? "middle" : "end");
+            printf("%-14s %-10.1f %-10.1f ", what, opened[c] / 1e6, ended[c] / 1e6);
+            benchLatencies("long line", what, samples[c][at], keys);
+            printf("\n");
+            free(samples[c][at]);
+        }
+        benchRecord("long line", names[c], "open ms", opened[c] / 1e6);
+        benchRecord("long line", names[c], "end ms", ended[c] / 1e6);
+    }
+    B->syntax = NULL;
+    B->filename = NULL;
+    editorFreeRows();
+    free(line);
+}
+
+// index every match of a query across the buffer, literal and as a pattern, against a plain
+// memmem scan of each row. the last pattern sends a backtracking matcher exponential
+void benchSearch() {
+    struct {
+        const char *query;
+        int regex;
+    } queries[] = {
+        { "benchmark", 0 },
+        { "line 99999", 0 },
+        { "absent", 0 },
+        { "benchmark", 1 },
+        { "line 9+ ", 1 },
+        { "b[a-z]+k|absent", 1 },
+        { "(\\w+\\w+)+!", 1 },
+    };
+    int numrows = 1000000;
+    benchFillRows(numrows);
+
+    long long bytes = 0;
+    for (int j = 0; j < numrows; j++) {
+        bytes += editorRowAt(j)->size;
+    }
+
+    printf("%-18s %-10s %-14s %-14s\n", "query", "matches", "index MB/s", "memmem MB/s");
+    for (unsigned int q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        const char *query = queries[q].query;
+        size_t len = strlen(query);
+
+        E.search.regex = queries[q].regex;
+        long long start = benchNow();
+        searchIndexStart(query);
+        pthread_mutex_lock(&E.search.lock);
+        while (!E.search.done) {
+            pthread_cond_wait(&E.search.progress, &E.search.lock);
+        }
+        pthread_mutex_unlock(&E.search.lock);
+        long long indexed = benchNow() - start;
+        int matches = E.search.count;
+        searchIndexReset();
+
+        char name[32];
+        snprintf(name, sizeof(name), queries[q].regex ? "/%s/" : "%s", query);
+        benchRecord("search", name, "index MB/s", bytes / (indexed / 1e9) / 1e6);
+        if (queries[q].regex) {
+            printf("%-18s %-10d %-14.1f\n", name, matches, bytes / (indexed / 1e9) / 1e6);
+            continue;
+        }
+
+        int found = 0;
+        start = benchNow();
+        for (int j = 0; j < numrows; j++) {
+            erow *row = editorRowAt(j);
+            const char *p = row->chars;
+            const char *end = row->chars + row->size;
+            while ((p = memmem(p, end - p, query, len)) != NULL) {
+                found++;
+                p++;
+            }
+        }
+        long long scanned = benchNow() - start;
+
+        printf("%-18s %-10d %-14.1f %-14.1f\n", name, matches,
+                bytes / (indexed / 1e9) / 1e6, bytes / (scanned / 1e9) / 1e6);
+        benchRecord("search", name, "memmem MB/s", bytes / (scanned / 1e9) / 1e6);
+        if (found != matches) {
+            printf("mismatch: memmem found %d\n", found);
+        }
+    }
+    E.search.regex = 0;
+    editorFreeRows();
+}
+
+// journal millions of edits, then time undo and redo per group at the end of that history
+void benchUndo() {
+    int edits = 2000000;
+    benchFillRows(10000);
+    editorUndoClear();
+
+    B->coordY = 10;
+    B->coordX = 0;
+    long long start = benchNow();
+    for (int j = 0; j < edits; j++) {
+        if (j % 4 == 3) {
+            editorDeleteChar();
+            B->undoBroken = 1; // as if the cursor moved, so every pair of keys is its own group
+        } else {
+            editorInsertChar('a' + j % 26);
+        }
+    }
+    long long recordNs = (benchNow() - start) / edits;
+
+    int groups = 100000;
+    start = benchNow();
+    for (int j = 0; j < groups; j++) {
+        editorUndo();
+    }
+    long long undoNs = (benchNow() - start) / groups;
+    start = benchNow();
+    for (int j = 0; j < groups; j++) {
+        editorRedo();
+    }
+    long long redoNs = (benchNow() - start) / groups;
+
+    printf("%-12s %-14s %-14s %-14s %-14s\n", "edits", "ns/edit", "ns/undo", "ns/redo", "journal KB");
+    printf("%-12d %-14lld %-14lld %-14lld %-14zu\n", edits, recordNs, undoNs, redoNs, B->undoLen / 1024);
+    benchRecord("undo", "journal", "ns/edit", recordNs);
+    benchRecord("undo", "journal", "ns/undo", undoNs);
+    benchRecord("undo", "journal", "ns/redo", redoNs);
+    benchRecord("undo", "journal", "journal KB", B->undoLen / 1024);
+    editorUndoClear();
+    editorFreeRows();
+}
+
+// replace-all of a million matches, then undo and redo of it. packed has ten matches on each of
+// 100k rows; spread has one on each of a million rows, the case that needs a row's undo record
+// to cost little more than its text
+void benchReplace() {
+    printf("%-12s %-12s %-12s %-12s %-12s\n", "case", "matches", "ms/replace", "ms/undo", "ms/redo");
+    for (int c = 0; c < 2; c++) {
+        const char *name = c == 0 ? "packed" : "spread";
+        if (c == 0) {
+            editorFreeRows();
+            char line[] = "foo bar foo bar foo bar foo bar foo bar foo bar foo bar foo bar foo bar foo bar";
+            for (int j = 0; j < 100000; j++) {
+                editorAppendRow(B->numrows, line, strlen(line));
+            }
+        } else {
+            benchFillRows(1000000);
+        }
+        editorUndoClear();
+
+        int rows;
+        long long start = benchNow();
+        int count = editorReplaceAll(c == 0 ? "foo" : "the", NULL, "quux", &rows);
+        long long replaceNs = benchNow() - start;
+        long long undoNs = 0, redoNs = 0;
+        if (count > 0) {
+            start = benchNow();
+            editorUndo();
+            undoNs = benchNow() - start;
+            start = benchNow();
+            editorRedo();
+            redoNs = benchNow() - start;
+        }
+
+        printf("%-12s %-12d %-12.1f ", name, count < 0 ? -count : count, replaceNs / 1e6);
+        benchRecord("replace", name, "ms/replace", replaceNs / 1e6);
+        if (count < 0) {
+            printf("%-12s %-12s\n", "-", "-");
+        } else {
+            printf("%-12.1f %-12.1f\n", undoNs / 1e6, redoNs / 1e6);
+            benchRecord("replace", name, "ms/undo", undoNs / 1e6);
+            benchRecord("replace", name, "ms/redo", redoNs / 1e6);
+        }
+        editorUndoClear();
+    }
+    editorFreeRows();
+}
+
+// repaint after typed characters and after single-line scrolls, with the terminal output
+// thrown away. reports bytes sent per keystroke, the number damage tracking keeps small
+struct benchFrames {
+    long long ns;
+    long long p50, p99;
+    unsigned long long bytes;
+    double allocs;
+};
+
+// one frame per key: mode 0 types a character, 1 scrolls one line, 2 repaints every cell.
+// allocations are counted through the wrapped malloc family
+struct benchFrames benchRedrawCase(int mode, int keys) {
+    struct benchFrames r;
+    long long *samples = malloc(sizeof(long long) * keys);
+    editorRefreshScreen();
+    E.totalFrameBytes = 0;
+    unsigned long long allocs = benchAllocs;
+    long long start = benchNow();
+    for (int j = 0; j < keys; j++) {
+        long long frameStart = benchNow();
+        if (mode == 0) {
+            editorInsertChar('x');
+        } else if (mode == 1) {
+            editorMoveCursor(ARROW_DOWN);
+            B->coordY = B->rowOffset + E.screenrows; // force a one-line scroll per key
+        } else {
+            E.frameValid = 0;
+        }
+        editorRefreshScreen();
+        samples[j] = benchNow() - frameStart;
+    }
+    r.ns = (benchNow() - start) / keys;
+    r.bytes = E.totalFrameBytes / keys;
+    r.allocs = (double) (benchAllocs - allocs) / keys;
+    qsort(samples, keys, sizeof(long long), benchCompareSamples);
+    r.p50 = benchPercentile(samples, keys, 50);
+    r.p99 = benchPercentile(samples, keys, 99);
+    free(samples);
+    return r;
+}
+
+void benchRedraw() {
+    const char *names[] = { "type", "scroll", "full 300x80" };
+    struct benchFrames r[3];
+
+    benchFillRows(100000);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    B->coordY = 10;
+    B->coordX = 0;
+    r[0] = benchRedrawCase(0, 2000);
+    r[1] = benchRedrawCase(1, 2000);
+
+    // a wide terminal, repainted from scratch every frame
+    int rows = E.screenrows, cols = E.screencols;
+    E.screenrows = 80;
+    E.screencols = 300;
+    editorFrameInit();
+    B->coordY = B->coordX = 0;
+    B->rowOffset = B->colOffset = 0;
+    r[2] = benchRedrawCase(2, 500);
+    E.screenrows = rows;
+    E.screencols = cols;
+    editorFrameInit();
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devnull);
+
+    printf("%-12s %-14s %-14s %-14s %-14s %-14s\n", "frame", "ns/frame", "p50 ns", "p99 ns", "bytes/frame",
+            "allocs/frame");
+    for (int j = 0; j < 3; j++) {
+        printf("%-12s %-14lld %-14lld %-14lld %-14llu %-14.2f\n", names[j], r[j].ns, r[j].p50, r[j].p99,
+                r[j].bytes, r[j].allocs);
+        benchRecord("redraw", names[j], "ns/frame", r[j].ns);
+        benchRecord("redraw", names[j], "p50 ns", r[j].p50);
+        benchRecord("redraw", names[j], "p99 ns", r[j].p99);
+        benchRecord("redraw", names[j], "bytes/frame", r[j].bytes);
+        benchRecord("redraw", names[j], "allocs/frame", r[j].allocs);
+    }
+    editorFreeRows();
+}
+
+long benchPeakRssMB() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024;
+}
+
+// open a generated file of the given size and save it under another name. the load and the save
+// run in a child of their own, so the peak RSS reading belongs to them and not to the benches
+// run before
+void benchSave(long long mb) {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char src[512], dst[512];
+    snprintf(src, sizeof(src), "%s/bench-save-src.txt", dir);
+    snprintf(dst, sizeof(dst), "%s/bench-save-dst.txt", dir);
+
+    FILE *fp = fopen(src, "w");
+    if (fp == NULL) {
+        printf("save: can't create %s: %s\n", src, strerror(errno));
+        return;
+    }
+    char line[160];
+    long long bytes = 0;
+    for (long long j = 0; bytes < mb * 1024 * 1024; j++) {
+        int len = snprintf(line, sizeof(line), "%012lld %s\n", j,
+                "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog");
+        fwrite(line, 1, len, fp);
+        bytes += len;
+    }
+    if (fclose(fp) == EOF) {
+        printf("save: can't write %s\n", src);
+        unlink(src);
+        return;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+    if (pid != 0) {
+        unlink(src);
+        unlink(dst);
+        return;
+    }
+
+    long rssBefore = benchPeakRssMB();
+    long long start = benchNow();
+    editorOpen((char *) src);
+    long long opened = benchNow() - start;
+    long rssOpen = benchPeakRssMB();
+
+    free(B->filename);
+    B->filename = strdup(dst);
+    start = benchNow();
+    saveFile();
+    long long saved = benchNow() - start;
+    long rssSave = benchPeakRssMB();
+
+    struct stat st;
+    int same = stat(dst, &st) == 0 && st.st_size == bytes;
+
+    printf("%-10s %-10s %-10s %-10s %-14s %-14s\n", "MB", "rows", "open s", "save s", "peak RSS MB",
+            "save RSS MB");
+    printf("%-10lld %-10d %-10.2f %-10.2f %-14ld %-14ld%s\n", bytes >> 20, B->numrows, opened / 1e9,
+            saved / 1e9, rssOpen - rssBefore, rssSave - rssOpen, same ? "" : "  (size mismatch)");
+    char what[32];
+    snprintf(what, sizeof(what), "%lld MB", bytes >> 20);
+    benchRecord("save", what, "open s", opened / 1e9);
+    benchRecord("save", what, "save s", saved / 1e9);
+    benchRecord("save", what, "peak RSS MB", rssOpen - rssBefore);
+    benchRecord("save", what, "save RSS MB", rssSave - rssOpen);
+    fflush(stdout);
+    _exit(0);
+}
+
+// type into files of two sizes with and without the swap journal running, then reopen each
+// file and replay its journal. replay should follow the journal's length, not the file's
+void benchJournal() {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char src[512];
+    snprintf(src, sizeof(src), "%s/bench-journal.c", dir);
+    int fileMB[] = { 1, 64 };
+    int keys[] = { 20000, 200000 };
+
+    journalInit();
+    printf("%-10s %-10s %-14s %-14s %-12s %-12s\n", "MB", "keys", "ns/key off", "ns/key on",
+            "journal KB", "replay ms");
+    for (int f = 0; f < 2; f++) {
+        FILE *fp = fopen(src, "w");
+        if (fp == NULL) {
+            printf("journal: can't create %s: %s\n", src, strerror(errno));
+            return;
+        }
+        for (long long bytes = 0, j = 0; bytes < (long long) fileMB[f] << 20; j++) {
+            bytes += fprintf(fp, "int value%lld = %lld; // the benchmark file\n", j, j * 7);
+        }
+        fclose(fp);
+
+        for (int k = 0; k < 2; k++) {
+            long long ns[2];
+            for (int on = 0; on < 2; on++) {
+                editorFreeRows();
+                B->journal.ready = on;
+                editorOpen(src);
+                B->coordY = 10;
+                B->coordX = 0;
+                long long start = benchNow();
+                for (int j = 0; j < keys[k]; j++) {
+                    if (j % 60 == 59) {
+                        editorInsertNewline();
+                    } else {
+                        editorInsertChar('a' + j % 26);
+                    }
+                }
+                ns[on] = (benchNow() - start) / keys[k];
+            }
+            int typedRows = B->numrows;
+            journalStop(0);
+
+            B->journal.ready = 0;
+            editorFreeRows();
+            editorOpen(src);
+            char *path = journalPath();
+            int fd = open(path, O_RDONLY);
+            struct stat st;
+            double replayMs = -1;
+            if (fd != -1 && fstat(fd, &st) == 0) {
+                char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    long long start = benchNow();
+                    journalReplay(data, st.st_size);
+                    replayMs = (benchNow() - start) / 1e6;
+                    munmap(data, st.st_size);
+                }
+            }
+            printf("%-10d %-10d %-14lld %-14lld %-12lld %-12.2f%s\n", fileMB[f], keys[k], ns[0], ns[1],
+                    fd != -1 ? (long long) st.st_size >> 10 : 0LL, replayMs,
+                    B->numrows == typedRows ? "" : "  (replay mismatch)");
+            char what[32];
+            snprintf(what, sizeof(what), "%d MB %d keys", fileMB[f], keys[k]);
+            benchRecord("journal", what, "ns/key off", ns[0]);
+            benchRecord("journal", what, "ns/key on", ns[1]);
+            benchRecord("journal", what, "replay ms", replayMs);
+            if (fd != -1) {
+                close(fd);
+            }
+            unlink(path);
+            free(path);
+        }
+    }
+    editorFreeRows();
+    editorUndoClear();
+    free(B->filename);
+    B->filename = NULL;
+    B->syntax = NULL;
+    B->journal.ready = 0;
+    unlink(src);
+}
+
+// append to a followed log in bursts and take each burst in, with every row kept and with the
+// history capped. then the log is truncated in place and one burst written to it again: the
+// rows still in the old mapping must be let go before its pages vanish, and every row left is
+// read back to prove it. each case runs in a child of its own for a clean peak RSS
+void benchFollow() {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bench-follow.log", dir);
+    int caps[] = { 0, 100000 };
+    int bursts = 200, burstRows = 10000;
+
+    printf("%-10s %-12s %-12s %-12s %-12s\n", "cap", "ns/row", "rows kept", "peak RSS MB", "ms/truncate");
+    fflush(stdout);
+    for (int c = 0; c < 2; c++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
+                printf("follow: can't create %s: %s\n", path, strerror(errno));
+                _exit(1);
+            }
+            char *burst = malloc(burstRows * 80);
+            int len = 0;
+            for (int j = 0; j < burstRows; j++) {
+                len += sprintf(&burst[len], "2024-01-01T00:00:00Z INFO request %d served in 12ms\n", j);
+            }
+            if (write(fd, burst, len) != len) {
+                _exit(1);
+            }
+
+            editorFreeRows();
+            B->follow.on = 1;
+            editorOpen(path);
+            editorFollowStart(caps[c]);
+
+            long long total = 0;
+            for (int b = 0; b < bursts; b++) {
+                if (write(fd, burst, len) != len) {
+                    _exit(1);
+                }
+                long long start = benchNow();
+                editorFollowPoll();
+                total += benchNow() - start;
+            }
+            int kept = B->numrows;
+
+            if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1 || write(fd, burst, len) != len) {
+                _exit(1);
+            }
+            long long start = benchNow();
+            editorFollowPoll();
+            long long truncateNs = benchNow() - start;
+            long long sum = 0;
+            for (int j = 0; j < B->numrows; j++) {
+                erow *row = editorRowAt(j);
+                for (int k = 0; k < row->size; k++) {
+                    sum += row->chars[k];
+                }
+            }
+            if (sum == 0) {
+                _exit(1);
+            }
+
+            printf("%-10d %-12lld %-12d %-12ld %-12.1f\n", caps[c], total / ((long long) bursts * burstRows),
+                    kept, benchPeakRssMB(), truncateNs / 1e6);
+            char what[32];
+            snprintf(what, sizeof(what), "cap %d", caps[c]);
+            benchRecord("follow", what, "ns/row", total / ((long long) bursts * burstRows));
+            benchRecord("follow", what, "peak RSS MB", benchPeakRssMB());
+            benchRecord("follow", what, "ms/truncate", truncateNs / 1e6);
+            fflush(stdout);
+            close(fd);
+            _exit(0);
+        }
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+    }
+    unlink(path);
+}
+
+// decode a stream of typed characters and escape sequences the way the event loop takes them
+// from the terminal: bulk reads into the ring, keys parsed from there. runs in a child with a
+// pipe for stdin
+void benchInput() {
+    const char *keys[] = { "a", "b", "\x1b[A", "\x1b[B", "\x1b[5~", "\x1b[1;5C", "\r", "\x7f" };
+    int nkeys = sizeof(keys) / sizeof(keys[0]);
+    int total = 1000000;
+
+    printf("%-12s %-12s %-12s %-12s\n", "keys", "ns/key", "bytes/key", "keys/read");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fds[2];
+        if (pipe(fds) == -1 || dup2(fds[0], STDIN_FILENO) == -1) {
+            _exit(1);
+        }
+        fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
+
+        char burst[INPUT_RING_SIZE];
+        long long bytes = 0, reads = 0, elapsed = 0;
+        int parsed = 0, sent = 0;
+        while (parsed < total) {
+            // a burst that fits the ring, as a terminal might deliver under fast typing
+            int len = 0, k;
+            while (sent < total && len + 8 <= (int) sizeof(burst)) {
+                k = strlen(keys[sent % nkeys]);
+                memcpy(&burst[len], keys[sent % nkeys], k);
+                len += k;
+                sent++;
+            }
+            if (write(fds[1], burst, len) != len) {
+                _exit(1);
+            }
+            bytes += len;
+
+            long long start = benchNow();
+            while (parsed < sent) {
+                if (editorParseKey() == -1) {
+                    editorInputFill();
+                    reads++;
+                    continue;
+                }
+                parsed++;
+            }
+            elapsed += benchNow() - start;
+        }
+        printf("%-12d %-12lld %-12.2f %-12.1f\n", total, elapsed / total, (double) bytes / total,
+                (double) total / reads);
+        benchRecord("input", "decode", "ns/key", elapsed / total);
+        benchRecord("input", "decode", "keys/read", (double) total / reads);
+        fflush(stdout);
+        _exit(0);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// paste text into the buffer the old way, a keystroke and a redraw per character, and as one
+// bracketed paste read from the input. runs in a child, stdin is a file holding the paste
+void benchPaste() {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bench-paste.txt", dir);
+    int sizes[] = { 10000, 1000000 };
+
+    printf("%-12s %-14s %-14s\n", "bytes", "per key ms", "paste ms");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int out = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        editorLoopInit();
+        char line[128];
+        for (int s = 0; s < 2; s++) {
+            struct abuf text = ABUF_INIT;
+            for (int j = 0; text.len < sizes[s]; j++) {
+                int len = snprintf(line, sizeof(line), "    int value%d = compute(%d, \"pasted\");\n", j, j);
+                abAppend(&text, line, len);
+            }
+            text.len = sizes[s];
+
+            double perKey = -1;
+            if (sizes[s] <= 100000) {
+                benchFillRows(10000);
+                B->coordY = 100;
+                B->coordX = 0;
+                long long start = benchNow();
+                for (int j = 0; j < text.len; j++) {
+                    if (text.b[j] == '\n') {
+                        editorInsertNewline();
+                    } else {
+                        editorInsertChar(text.b[j]);
+                    }
+                    editorRefreshScreen();
+                }
+                perKey = (benchNow() - start) / 1e6;
+            }
+
+            int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1 || write(fd, "\x1b[200~", 6) != 6 || write(fd, text.b, text.len) != text.len ||
+                    write(fd, PASTE_END, 6) != 6) {
+                _exit(1);
+            }
+            lseek(fd, 0, SEEK_SET);
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+            E.loop.head = E.loop.tail = 0;
+
+            benchFillRows(10000);
+            B->coordY = 100;
+            B->coordX = 0;
+            long long start = benchNow();
+            editorProcessKeypress();
+            editorRefreshScreen();
+            double paste = (benchNow() - start) / 1e6;
+
+            char perKeyText[32] = "-";
+            if (perKey >= 0) {
+                snprintf(perKeyText, sizeof(perKeyText), "%.2f", perKey);
+            }
+            dprintf(out, "%-12d %-14s %-14.2f\n", sizes[s], perKeyText, paste);
+            char what[32];
+            snprintf(what, sizeof(what), "%d bytes", sizes[s]);
+            if (perKey >= 0) {
+                benchRecord("paste", what, "per key ms", perKey);
+            }
+            benchRecord("paste", what, "paste ms", paste);
+            abFree(&text);
+        }
+        unlink(path);
+        _exit(0);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// load rows onto the heap and type into random ones, once from slabs and once with plain
+// malloc/realloc. each runs in a child of its own, so the peak RSS reading is its alone
+void benchAlloc() {
+    int numrows = 2000000;
+    int edits = 1000000;
+    const char *modes[] = { "slab", "malloc" };
+
+    printf("%-8s %-12s %-12s %-12s %-14s %-14s\n", "alloc", "ns/row", "ns/edit", "peak RSS MB",
+            "mallocs/row", "mallocs/edit");
+    fflush(stdout);
+    for (int m = 0; m < 2; m++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            editorFreeRows();
+            slabReset(m);
+            srand(1);
+
+            char line[96];
+            unsigned long long allocs = benchAllocs;
+            long long start = benchNow();
+            for (int j = 0; j < numrows; j++) {
+                int len = 5 + rand() % 75;
+                memset(line, 'a' + j % 26, len);
+                editorAppendRow(B->numrows, line, len);
+            }
+            long long fillNs = (benchNow() - start) / numrows;
+            double fillAllocs = (double) (benchAllocs - allocs) / numrows;
+
+            allocs = benchAllocs;
+            start = benchNow();
+            for (int j = 0; j < edits; j++) {
+                int row = rand() % numrows;
+                editorRowInsertChar(row, rand() % (editorRowAt(row)->size + 1), 'x');
+            }
+            long long editNs = (benchNow() - start) / edits;
+            double editAllocs = (double) (benchAllocs - allocs) / edits;
+
+            printf("%-8s %-12lld %-12lld %-12ld %-14.3f %-14.3f\n", modes[m], fillNs, editNs,
+                    benchPeakRssMB(), fillAllocs, editAllocs);
+            benchRecord("alloc", modes[m], "ns/row", fillNs);
+            benchRecord("alloc", modes[m], "ns/edit", editNs);
+            benchRecord("alloc", modes[m], "peak RSS MB", benchPeakRssMB());
+            benchRecord("alloc", modes[m], "mallocs/row", fillAllocs);
+            benchRecord("alloc", modes[m], "mallocs/edit", editAllocs);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+    }
+}
+
+// open generated C files of a few sizes over and over. each size runs in a child of its own, so
+// the peak RSS reading belongs to its opens alone
+void benchOpen() {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bench-open.c", dir);
+    int sizes[] = { 1, 16, 128 }; // MB
+    int reps[] = { 50, 20, 5 };
+
+    printf("%-10s %-10s %-10s %-10s %-10s %-10s %-12s %-12s\n", "MB", "rows", "p50 us", "p90 us", "p99 us",
+            "max us", "allocs/open", "peak RSS MB");
+    fflush(stdout);
+    for (int s = 0; s < 3; s++) {
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            printf("open: can't create %s: %s\n", path, strerror(errno));
+            return;
+        }
+        for (long long bytes = 0, j = 0; bytes < (long long) sizes[s] << 20; j++) {
+            bytes += fprintf(fp, "    int value%lld = compute(%lld, \"opened\"); // row\n", j, j);
+        }
+        fclose(fp);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            long long samples[64];
+            unsigned long long allocs = 0;
+            for (int r = 0; r < reps[s]; r++) {
+                unsigned long long before = benchAllocs;
+                long long start = benchNow();
+                editorOpen(path);
+                samples[r] = benchNow() - start;
+                allocs += benchAllocs - before;
+                if (r < reps[s] - 1) {
+                    editorFreeRows();
+                    munmap(B->map, B->mapSize);
+                    B->map = NULL;
+                }
+            }
+            char what[32];
+            snprintf(what, sizeof(what), "%d MB", sizes[s]);
+            printf("%-10d %-10d ", sizes[s], B->numrows);
+            benchLatencies("open", what, samples, reps[s]);
+            printf(" %-12llu %-12ld\n", allocs / reps[s], benchPeakRssMB());
+            benchRecord("open", what, "allocs/open", allocs / reps[s]);
+            benchRecord("open", what, "peak RSS MB", benchPeakRssMB());
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+    }
+    unlink(path);
+}
+
+// type queries into the search prompt's callback a key at a time over 1M rows, then step
+// through the matches with the arrows. each call is timed whole: restarting the index, waiting
+// for the match to seek to, and highlighting it
+void benchSearchKeys() {
+    const char *queries[] = { "line 7", "benchmark buffer", "line 99999 of", "absent", "of the" };
+    int nqueries = sizeof(queries) / sizeof(queries[0]);
+    int steps = 100;
+    benchFillRows(1000000);
+
+    long long typed[128], stepped[512];
+    int ntyped = 0, nstepped = 0;
+    for (int q = 0; q < nqueries; q++) {
+        char term[64] = "";
+        int len = strlen(queries[q]);
+        for (int i = 0; i < len; i++) {
+            term[i] = queries[q][i];
+            term[i + 1] = '\0';
+            long long start = benchNow();
+            searchCB(term, term[i]);
+            typed[ntyped++] = benchNow() - start;
+        }
+        for (int i = 0; i < steps && nstepped < 512; i++) {
+            long long start = benchNow();
+            searchCB(term, ARROW_DOWN);
+            stepped[nstepped++] = benchNow() - start;
+        }
+        searchCB(term, '\r');
+    }
+
+    printf("%-12s %-10s %-10s %-10s %-10s %-10s\n", "searchCB", "calls", "p50 us", "p90 us", "p99 us",
+            "max us");
+    printf("%-12s %-10d ", "type", ntyped);
+    benchLatencies("search keys", "type", typed, ntyped);
+    printf("\n%-12s %-10d ", "next match", nstepped);
+    benchLatencies("search keys", "next match", stepped, nstepped);
+    printf("\n");
+    editorFreeRows();
+}
+
+// the key under the input ring's head, left there. -1 if no whole key is waiting
+int benchPeekKey() {
+    unsigned int head = E.loop.head;
+    long long escSince = E.loop.escSince;
+    int key = editorParseKey();
+    E.loop.head = head;
+    E.loop.escSince = escSince;
+    return key;
+}
+
+// move the next key of the stream into the input ring a byte at a time, the way a terminal
+// delivers a keystroke typed at human speed. stdin is the stream too and is kept positioned
+// after what has been taken, so input the editor reads for itself (the rest of a paste, keys
+// typed into a prompt) comes from the same place. returns the key, -1 at the end
+int benchFeedKey(const char *stream, size_t len, size_t *fed) {
+    while (benchPeekKey() == -1) {
+        if (*fed == len) {
+            return -1;
+        }
+        E.loop.ring[E.loop.tail++ & (INPUT_RING_SIZE - 1)] = stream[(*fed)++];
+        if (E.perf.timing) {
+            E.perf.readAt = editorNowNs();
+        }
+    }
+    lseek(STDIN_FILENO, *fed, SEEK_SET);
+    return benchPeekKey();
+}
+
+// a session to replay when no recording is given: typing, cursor keys, paging, a search,
+// undo and redo, a bracketed paste
+void benchReplaySession(struct abuf *keys) {
+    for (int j = 0; j < 300; j++) {
+        abAppend(keys, "hello, world ", 13);
+        if (j % 5 == 4) {
+            abAppend(keys, "\r", 1);
+        }
+        if (j % 20 == 19) {
+            for (int k = 0; k < 30; k++) {
+                abAppend(keys, "\x1b[B", 3);
+            }
+            abAppend(keys, "\x1b[6~\x1b[6~\x1b[5~\x1b[D\x1b[D\x7f", 20);
+        }
+    }
+    abAppend(keys, "\x06line 5", 7);
+    for (int k = 0; k < 20; k++) {
+        abAppend(keys, "\x1b[B", 3);
+    }
+    abAppend(keys, "\r", 1);
+    for (int k = 0; k < 100; k++) {
+        abAppend(keys, "\x1a", 1);
+    }
+    for (int k = 0; k < 100; k++) {
+        abAppend(keys, "\x19", 1);
+    }
+    abAppend(keys, "\x1b[200~", 6);
+    for (int k = 0; k < 100; k++) {
+        abAppend(keys, "    pasted(line);\n", 18);
+    }
+    abAppend(keys, PASTE_END, 6);
+}
+
+// play a key stream through the editor a key at a time, with the screen refreshed after each
+// as the main loop does, and time every key. the stream is a recording made with
+// text-editor -r, or the generated session. runs in a child: stdin is the stream and the
+// frames go to /dev/null. played twice, the second time timed as with the overlay up and a
+// trace written, which should cost next to nothing
+void benchReplay(const char *keylog) {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512], save[512];
+    snprintf(path, sizeof(path), "%s/bench-replay.keys", dir);
+    snprintf(save, sizeof(save), "%s/bench-replay.txt", dir);
+    const char *stream = keylog ? keylog : path;
+    if (keylog == NULL) {
+        struct abuf keys = ABUF_INIT;
+        benchReplaySession(&keys);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write(fd, keys.b, keys.len) != keys.len) {
+            printf("replay: can't write %s\n", path);
+            return;
+        }
+        close(fd);
+        abFree(&keys);
+    }
+
+    printf("%-16s %-10s %-10s %-10s %-10s %-10s %-12s %-12s\n", "replay", "keys", "p50 us", "p90 us", "p99 us",
+            "max us", "allocs/key", "peak RSS MB");
+    fflush(stdout);
+    for (int timed = 0; timed < 2; timed++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int in = open(stream, O_RDONLY);
+            struct stat st;
+            char *keys = MAP_FAILED;
+            if (in != -1 && fstat(in, &st) == 0 && st.st_size > 0) {
+                keys = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+            }
+            if (keys == MAP_FAILED) {
+                printf("replay: can't read %s\n", stream);
+                _exit(1);
+            }
+            dup2(in, STDIN_FILENO);
+            close(in);
+            int out = dup(STDOUT_FILENO);
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            editorLoopInit();
+            if (timed) {
+                E.perf.overlay = 1;
+                perfTraceStart("/dev/null");
+            }
+            benchFillRows(100000);
+            // a save in the recording goes to a scratch file rather than asking for a name
+            B->filename = save;
+            B->coordY = B->coordX = 0;
+            B->rowOffset = B->colOffset = 0;
+            editorRefreshScreen();
+
+            long long *samples = NULL;
+            int n = 0, cap = 0;
+            unsigned long long allocs = 0;
+            size_t fed = 0;
+            while (1) {
+                // the stream is over, or the session quit
+                int key = benchFeedKey(keys, st.st_size, &fed);
+                if (key == -1 || key == CTRL_KEY('q')) {
+                    break;
+                }
+                if (n == cap) {
+                    cap = cap ? cap * 2 : 4096;
+                    samples = realloc(samples, sizeof(long long) * cap);
+                }
+                unsigned long long before = benchAllocs;
+                long long start = benchNow();
+                editorProcessKeypress();
+                if (!editorKeyPending()) {
+                    editorRefreshScreen();
+                }
+                samples[n++] = benchNow() - start;
+                allocs += benchAllocs - before;
+                fed = lseek(STDIN_FILENO, 0, SEEK_CUR);
+            }
+
+            char what[64];
+            snprintf(what, sizeof(what), "%s%s", keylog ? (strrchr(keylog, '/') ? strrchr(keylog, '/') + 1 : keylog)
+                    : "generated", timed ? " timed" : "");
+            char line[256];
+            if (n == 0) {
+                dprintf(out, "%-16s no keys\n", what);
+                _exit(0);
+            }
+            // benchLatencies prints to stdout, which is /dev/null here
+            qsort(samples, n, sizeof(long long), benchCompareSamples);
+            snprintf(line, sizeof(line), "%-16.16s %-10d %-10.1f %-10.1f %-10.1f %-10.1f %-12.2f %-12ld\n", what, n,
+                    benchPercentile(samples, n, 50) / 1e3, benchPercentile(samples, n, 90) / 1e3,
+                    benchPercentile(samples, n, 99) / 1e3, samples[n - 1] / 1e3, (double) allocs / n,
+                    benchPeakRssMB());
+            dprintf(out, "%s", line);
+            benchLatencies("replay", what, samples, n);
+            benchRecord("replay", what, "allocs/key", (double) allocs / n);
+            benchRecord("replay", what, "peak RSS MB", benchPeakRssMB());
+            unlink(save);
+            _exit(0);
+        }
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+    }
+    if (keylog == NULL) {
+        unlink(path);
+    }
+}
+
+// for every record of this run that moved by 5% or more against the baseline, print both
+// values. records are read back from the fd they were written to
+void benchCompare(const char *baseline, int fd) {
+    FILE *base = fopen(baseline, "r");
+    if (base == NULL) {
+        printf("compare: can't open %s: %s\n", baseline, strerror(errno));
+        return;
+    }
+    struct benchRecordLine {
+        char key[192];
+        double value;
+    } *old = NULL;
+    int nold = 0, cap = 0;
+    char line[256], bench[64], what[64], metric[64];
+    double value;
+    while (fgets(line, sizeof(line), base)) {
+        if (sscanf(line, "%63[^\t]\t%63[^\t]\t%63[^\t]\t%lf", bench, what, metric, &value) != 4) {
+            continue;
+        }
+        if (nold == cap) {
+            cap = cap ? cap * 2 : 256;
+            old = realloc(old, sizeof(struct benchRecordLine) * cap);
+        }
+        snprintf(old[nold].key, sizeof(old[nold].key), "%s\t%s\t%s", bench, what, metric);
+        old[nold].value = value;
+        nold++;
+    }
+    fclose(base);
+
+    FILE *cur = fdopen(dup(fd), "r");
+    if (cur == NULL) {
+        free(old);
+        return;
+    }
+    rewind(cur);
+    printf("%-16s %-20s %-14s %-14s %-14s %-8s\n", "compare", "case", "metric", "baseline", "now", "change");
+    int same = 0, missing = 0;
+    while (fgets(line, sizeof(line), cur)) {
+        if (sscanf(line, "%63[^\t]\t%63[^\t]\t%63[^\t]\t%lf", bench, what, metric, &value) != 4) {
+            continue;
+        }
+        char key[192];
+        snprintf(key, sizeof(key), "%s\t%s\t%s", bench, what, metric);
+        int j = 0;
+        while (j < nold && strcmp(old[j].key, key) != 0) {
+            j++;
+        }
+        if (j == nold) {
+            missing++;
+            continue;
+        }
+        double change = old[j].value != 0 ? (value - old[j].value) / old[j].value * 100 : (value != 0 ? 100 : 0);
+        if (change > -5 && change < 5) {
+            same++;
+            continue;
+        }
+        printf("%-16s %-20s %-14s %-14.6g %-14.6g %+.1f%%\n", bench, what, metric, old[j].value, value, change);
+    }
+    printf("%d within 5%%, %d not in the baseline\n", same, missing);
+    fclose(cur);
+    free(old);
+}
+
+int main(int argc, char *argv[]) {
+    char *outPath = NULL, *baseline = NULL, *keylog = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:c:r:")) != -1) {
+        if (opt == 'o') {
+            outPath = optarg;
+        } else if (opt == 'c') {
+            baseline = optarg;
+        } else if (opt == 'r') {
+            keylog = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-o results.tsv] [-c baseline.tsv] [-r keylog] [save MB]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (outPath) {
+        benchOut = open(outPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (benchOut == -1) {
+            perror(outPath);
+            return 1;
+        }
+    } else if (baseline) {
+        // comparing needs this run's records too, kept in a file nobody sees
+        char tmp[] = "/tmp/bench-records.XXXXXX";
+        benchOut = mkstemp(tmp);
+        if (benchOut != -1) {
+            unlink(tmp);
+        }
+    }
+
+    E.screenrows = 24;
+    E.screencols = 80;
+    B = editorBufferNew();
+    editorRenderCacheInit(E.screenrows * RENDER_CACHE_SCREENS);
+    editorFrameInit();
+    searchIndexInit();
+
+    benchAlloc();
+    printf("\n");
+    benchFollow();
+    printf("\n");
+    benchOpen();
+    printf("\n");
+    benchSave(optind < argc ? atoll(argv[optind]) : 1024);
+    printf("\n");
+    benchKeystrokes();
+    printf("\n");
+    benchHighlight();
+    printf("\n");
+    benchHighlightScan();
+    printf("\n");
+    benchSyntax();
+    printf("\n");
+    benchColumns();
+    printf("\n");
+    benchLongLine();
+    printf("\n");
+    benchSearch();
+    printf("\n");
+    benchSearchKeys();
+    printf("\n");
+    benchUndo();
+    printf("\n");
+    benchReplace();
+    printf("\n");
+    benchJournal();
+    printf("\n");
+    benchInput();
+    printf("\n");
+    benchPaste();
+    printf("\n");
+    benchReplay(keylog);
+    printf("\n");
+    benchRedraw();
+    if (baseline && benchOut != -1) {
+        printf("\n");
+        benchCompare(baseline, benchOut);
+    }
+    return 0;
+}
@@ -10,10 +10,23 @@
 #include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define SEARCH_SSE2
+#endif
 
 // DEFINE
 #define EDITOR_VERSION "0.0.1"
@@ -22,6 +35,59 @@
 #define REMAINING_QUIT_ATTEMPTS 3
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define LOAD_PARALLEL_MIN_BYTES (4 * 1024 * 1024) // below this, a single thread scans faster than spawning
+#define LOAD_MAX_THREADS 16
+#define ROW_LEAF_SIZE 256 // rows per leaf block of the row tree
+#define ROW_TREE_MAX_DEPTH 96
+#define RENDER_CACHE_SCREENS 4 // rendered rows kept around, in screenfuls
+#define RENDER_CACHE_MIN_ROWS 64
+#define HL_IDLE_ROWS 20000 // rows restyled per idle tick while the highlight frontier catches up
+#define HL_PARALLEL_MIN_ROWS 100000 // below this a load leaves the frontier to catch up lazily
+#define CELL_INVERSE 0x80
+#define CELL_GLYPH '\x01' // frame text for a cell whose UTF-8 bytes are in the frame's glyphs
+#define CELL_WIDE_TAIL '\x02' // frame text for the right half of a two-column glyph
+#define FRAME_GLYPH_BYTES 16 // per cell: a length byte, then the glyph, cut to what fits
+#define COLUMN_MARK_STRIDE 64 // chars between column map marks, the most a lookup walks
+#define LONG_ROW_BYTES (64 * 1024) // rows this long are mapped in chunks and rendered around the screen only
+#define LONG_ROW_CHUNK 4096 // chars between the chunks of a long row
+#define DAMAGE_GAP 6 // unchanged cells worth rewriting rather than moving the cursor past
+#define ABUF_MIN_CAP 4096
+#define ABUF_REF_MIN 48 // runs at least this long are sent from the frame in place, not copied
+#define SEARCH_LEAF_MATCHES 1024 // matches the search worker collects before taking the lock
+#define SEARCH_PROMPT "Search: %s (ESC/Arrows/Enter, Ctrl-R regex)"
+#define SEARCH_PROMPT_REGEX "Regex: %s (ESC/Arrows/Enter, Ctrl-R literal)"
+#define SEARCH_PROMPT_INVALID "Regex: %s (incomplete pattern)"
+#define REGEX_DFA_MAX_STATES 4096 // lazily built DFA states kept before the cache is emptied
+#define REGEX_DFA_HASH 8192 // power of two above REGEX_DFA_MAX_STATES
+#define DFA_UNKNOWN -2
+#define DFA_DEAD -1
+#define SLAB_MIN_SHIFT 4 // smallest row block is 16 bytes
+#define SLAB_CLASSES 9 // 16 bytes to 4KB, larger blocks come from malloc
+#define SLAB_CHUNK_BYTES (256 * 1024)
+#ifndef UNDO_MAX_BYTES
+#define UNDO_MAX_BYTES (64 * 1024 * 1024) // undo journal cap, the oldest edits are forgotten past it
+#endif
+#define FOLLOW_READ_BYTES (64 * 1024)
+#define FOLLOW_RETRY_MS 250 // how often a rotated log is looked for under its name
+#define INPUT_RING_SIZE 4096 // power of two
+#define ESC_TIMEOUT_MS 100 // how long a lone ESC waits for the rest of a sequence
+#define ESC_SEQ_MAX 16 // longer escape sequences are not ours
+#define STATUS_MSG_SECONDS 5
+#define PASTE_TIMEOUT_MS 1000 // a paste whose end marker does not come within this is cut short
+#define PASTE_END "\x1b[201~"
+#define TYPED_BATCH 256 // typed characters already waiting are inserted this many at a time
+#define PERF_LATENCIES 256 // key-to-paint times the overlay takes its percentiles over
+#define TRACE_EVENTS 4096 // trace events held before they are written out
+#define BATCH_MAX_THREADS 64
+#define BATCH_LAST INT_MAX // $ in a batch script line address
+#define JOURNAL_MAGIC "edswap1" // 8 bytes with the terminator
+#define SYNTAX_DIR ".text-editor/syntax" // under $HOME, -s names another
+#define SYNTAX_SUFFIX ".syntax"
+#define SYNTAX_CACHE "syntax.cache" // the definitions compiled, beside them
+#define SYNTAX_MAGIC "edsynt1" // 8 bytes with the terminator
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 enum editorKey {
     BACKSPACE = 127,
@@ -34,6 +100,14 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     DEL_KEY,
+    TASK_DONE, // not a key: a background task finished while a prompt was open
+    PASTE_BEGIN, // bracketed paste, the text follows in the input up to PASTE_END
+};
+
+// why the event loop was woken through its pipe
+enum wakeReason {
+    WAKE_RESIZE = 'r',
+    WAKE_TASK = 't'
 };
 
 enum editorHighlight {
@@ -49,6 +123,16 @@ enum editorHighlight {
 
 // Information
 
+// keywords compiled into a DFA over the bytes that occur in them, so a lookup is one table
+// step per character of the token
+struct keywordTrie {
+    unsigned char classOf[256]; // byte -> column in next, 0 for bytes in no keyword
+    int classes;
+    int *next; // nodes * classes, 0 means no edge (the root is never a target)
+    unsigned char *match; // HL_KEYWORD_1/2 when a keyword ends at this node, else 0
+    int nodes;
+};
+
 struct editorSyntax {
     char *filetype;
     char **filematch;
@@ -57,33 +141,378 @@ struct editorSyntax {
     char *multiline_comment_start;
     char *multiline_comment_end;
     int flags;
+    struct keywordTrie *keywordTrie; // compiled from keywords into the syntax image
+};
+
+// syntax definitions compiled into one block, written to SYNTAX_CACHE and mapped back from it
+// as it is. offsets are from the start of the image, strings are NUL terminated, 0 is none
+// (the header is at 0, never a string)
+struct syntaxImageHeader {
+    char magic[8];
+    unsigned long long fingerprint; // of the definition files it was compiled from
+    int size; // of the whole image
+    int nsyntax;
+    int syntaxOff; // nsyntax syntaxImageEntry
+    int slots; // hash slots, a power of two
+    int slotsOff;
+};
+
+struct syntaxImageEntry {
+    int filetype;
+    int scs, mcs, mce; // single line comment start, block comment start and end
+    int flags;
+    int classes, nodes; // the keyword DFA, as in keywordTrie
+    int classOf; // 256 bytes
+    int next; // nodes * classes ints
+    int match; // nodes bytes
+};
+
+// an extension (with its dot) or a whole file name, to the syntax it selects. open addressing
+// with linear probing
+struct syntaxImageSlot {
+    unsigned int hash;
+    int key; // 0 for an empty slot
+    int syntax;
+};
+
+// the syntaxes in use, read out of the image. their strings and keyword tables point into it
+struct syntaxTable {
+    char *image;
+    int size;
+    int mapped; // image is the cache file mapped, not malloc'd
+    struct editorSyntax *syntaxes;
+    struct keywordTrie *tries;
+    int nsyntax;
 };
 
 typedef struct erow { // erow -> editor row
     int size;
-    int renderSize; // content size of render
+    int cap; // bytes allocated for chars, 0 while they point into the file mapping
     char *chars;
-    char *render;
-    unsigned char *highlight;
-    int idx; // current index
     int hl_open_comment; // open/unclosed comment
+    int renderSlot; // render cache slot, -1 when not rendered
+    unsigned int renderGen; // slot generation this row was rendered into
 } erow;
 
-struct editorConfig {
+// a place in a row where its offset in chars, its offset in render and its screen column
+// are all known
+struct columnMark {
+    int chars;
+    int render;
+    int column;
+};
+
+// how far styling has got at some point of a row, enough to carry on from there
+struct hlState {
+    int in_comment;
+    int in_string; // the quote that opened it
+    int prev_sep;
+    int prev_number; // the char before was styled as part of a number
+    int line_comment; // a single line comment runs to the end of the row
+    int carry; // bytes past this point still taken by a token started before it
+    int carry_hl; // and their highlight
+};
+
+// a long row is cut into chunks of about LONG_ROW_CHUNK chars, each starting on a glyph
+// boundary, with its column and the styling state there
+struct longChunk {
+    struct columnMark at;
+    struct hlState hl;
+    int tabs; // there is a tab before the next chunk
+    int known; // at and hl were right before the last edits, only shifted since
+};
+
+// render and highlight are only kept for recently drawn rows, in a fixed pool of slots
+// recycled least-recently-used first. a slot belongs to a row while its gen matches the row's.
+// a long row keeps a chunk map instead of marks, and render holds only its window: the chunks
+// around the columns on screen
+struct rowRender {
+    char *render;
+    unsigned char *highlight;
+    int renderSize; // content size of render
+    int cap; // bytes allocated for render and highlight
+    struct columnMark *marks; // column map: mark k at the first glyph boundary from chars k * COLUMN_MARK_STRIDE
+    int nmarks;
+    int marksCap; // bytes allocated for marks
+    int marksChunk; // the chunk of a long row its marks are for, -1 for none
+    int longRow;
+    struct longChunk *chunks; // the last one is at the end of the row
+    int nchunks;
+    int chunksCap; // bytes allocated for chunks
+    int chunksValid; // chunks before this one are right, the rest are worked out when asked for
+    int chunksDone; // chunks before this one have all been worked out at some point
+    int chunksDirty; // edited since the chunks after the edit were last back in step
+    int winFrom, winTo; // render holds the chunks from winFrom to winTo, winTo -1 when stale
+    int winBase; // render offset of chunk winFrom in the whole row
+    int winColumnFrom, winColumnTo; // the screen columns the window was built for lie within these
+    unsigned int gen; // bumped every time the slot changes hands
+    int prev, next; // LRU list, head is most recently used
+};
+
+// free blocks of one slab size class, and the chunk they are carved from
+struct slabClass {
+    void *freeList; // linked through the first bytes of each free block
+    char *next, *end; // uncarved part of the current chunk
+};
+
+struct slabArena {
+    struct slabClass classes[SLAB_CLASSES];
+    char **chunks;
+    int nchunks, chunksCap;
+    int useMalloc; // plain malloc/realloc at exact sizes instead, to compare against
+};
+
+// rows live in a balanced tree of fixed-size leaf blocks. every node knows how many rows sit
+// under it, so a row is found by index in O(log n) and inserting or deleting one only shifts
+// the rest of its leaf
+typedef struct rowNode {
+    struct rowNode *left, *right; // both NULL on a leaf
+    int count; // rows under this node
+    int leaves; // leaf blocks under this node, used to spot imbalance
+    erow *rows; // leaf only, ROW_LEAF_SIZE slots
+} rowNode;
+
+// the terminal's cells as they were (or will be) on screen, one row after another
+struct screenFrame {
+    char *text; // one byte per cell, or CELL_GLYPH / CELL_WIDE_TAIL
+    unsigned char *attr; // foreground colour code (0 for default), CELL_INVERSE for reverse video
+    char *glyphs; // FRAME_GLYPH_BYTES per cell, only meaningful where text is CELL_GLYPH
+};
+
+struct searchMatch {
+    int row;
+    int col; // in chars
+    int len;
+};
+
+struct regex;
+
+// every match of the search query in the buffer, in (row, col) order. a worker thread fills it
+// while the prompt is open, the buffer does not change underneath it until the prompt closes
+struct searchIndex {
+    pthread_mutex_t lock;
+    pthread_cond_t progress; // signalled when matches are added and when the scan ends
+    pthread_t worker;
+    int running; // worker started and not yet joined
+    int cancel;
+    char *query;
+    int queryLen;
+    int regex; // the query is a pattern rather than literal text
+    struct regex *re; // the compiled pattern, NULL when it does not parse
+    rowNode **leaves; // snapshot of the row tree's leaves, in order
+    int nleaves;
+    struct searchMatch *matches;
+    int count, cap;
+    int scanned; // rows below this are in the index
+    int done;
+};
+
+// one journalled edit: text inserted at or deleted from (row, col), '\n' standing for a row
+// break. the text follows the header in the journal
+struct undoOp {
+    int kind; // UNDO_INSERT, UNDO_DELETE or UNDO_REPLACE
+    int run; // typed characters, later keystrokes extend it
+    int group; // ops undone together share a group
+    int row, col; // for UNDO_REPLACE, row is how many rows it rewrote
+    int len;
+    int prevSize; // bytes back to the previous op's header, 0 for the oldest
+};
+
+enum undoKind {
+    UNDO_INSERT,
+    UNDO_DELETE,
+    UNDO_REPLACE // a whole replace-all, never journalled as one record
+};
+
+// a row's part in an UNDO_REPLACE: chars [col, col + oldLen) became newLen bytes. the op's
+// text is one of these per row, then every row's old text, then every row's new text
+struct undoReplace {
+    int row, col;
+    int oldLen, newLen;
+};
+
+// the swap file starts with the identity of the file its edits apply to, then one record per
+// edit: inserts carry their text, deletes only a length
+struct journalHeader {
+    char magic[8];
+    long long size;
+    long long mtimeSec, mtimeNsec;
+    long long ino;
+    int pid; // editor that wrote it, a live one still owns it
+};
+
+struct journalRecord {
+    int kind; // UNDO_INSERT or UNDO_DELETE
+    int row, col;
+    int len;
+};
+
+// edits since the last save, appended to a swap file beside the file by a background thread.
+// the editor only copies records into pending under the lock, the writer swaps buffers with it
+// and does the I/O unlocked, so a slow disk never holds up a keystroke
+struct editorJournal {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t writer;
+    int ready; // lock and cond initialised, journalling is off until then
+    int running; // writer started and not yet joined
+    int stop;
+    char *path; // swap file, NULL when edits are not journalled
+    int fd; // writer only, -1 until the first records arrive
+    int restart; // writer removes the swap file and starts a new one
+    struct journalHeader header;
+    char *pending;
+    size_t pendingLen, pendingCap;
+    int failed; // errno of the writer's last failure, 0 once reported
+};
+
+// a file being tailed: bytes appended to it are read as they land and become new rows
+struct editorFollow {
+    int on;
+    int fd; // the file being read, -1 while a rotated log has not reappeared
+    int watch; // inotify instance
+    int wd; // watch on the file
+    off_t offset; // bytes of the file read so far
+    int partial; // the last row has no newline yet, the next bytes continue it
+    int maxRows; // the oldest rows are dropped past this many, 0 keeps them all
+    size_t released; // mapping bytes below this have been given back
+};
+
+// input read ahead of the key parser, and what else the event loop waits on
+struct editorLoop {
+    char ring[INPUT_RING_SIZE];
+    unsigned int head, tail; // keys are parsed at head, input is read in at tail. both only grow
+    int wake[2]; // self-pipe written by the SIGWINCH handler and by worker threads
+    int ready; // the pipe exists, wake-ups before then are dropped
+    long long escSince; // when a lone ESC began waiting for the rest of its sequence, 0 if none
+    int taskDone; // a background task finished and has not been looked at
+    int record; // with -r every byte of input is copied here for bench to replay, 0 for none
+};
+
+// one span of the trace, in ns, with what the span did
+struct perfEvent {
+    const char *name;
+    long long start, dur;
+    long long bytes; // written to the terminal or the file
+    unsigned long long rows; // rows restyled
+    long long styleNs;
+};
+
+// taken at the start of a span, the counters are differenced at its end
+struct perfSpan {
+    long long start; // 0 while nothing is timed
+    unsigned long long rows;
+    long long styleNs;
+};
+
+// timers and counters on the hot paths, kept only while the overlay is up or a trace is being
+// written. a batch run never times, so its workers never touch them
+struct editorPerf {
+    int timing; // overlay or trace
+    int overlay; // ^T shows key-to-paint latency in the status bar
+    int trace; // -t writes spans here as Chrome trace JSON, 0 for none
+    long long epoch; // trace timestamps count from here
+    long long readAt; // when input last arrived
+    long long keyAt; // when the first key not yet painted arrived, 0 for none
+    unsigned long long keyRows; // rowsStyled and styleNs when that key was read
+    long long keyStyleNs;
+    unsigned long long rowsStyled;
+    long long styleNs; // spent styling rows, while timing
+    long long latency[PERF_LATENCIES]; // key to paint, the last ones in a ring
+    long long sorted[PERF_LATENCIES]; // the same ones in order, for the p99
+    unsigned long nlatency;
+    unsigned long long lastRows; // rows restyled between the last key painted and its paint
+    struct perfEvent *events; // waiting to be written
+    int nevents;
+    unsigned long written; // events in the trace file so far
+};
+
+// Append Buffer -> pointer to buffer in memory. it is kept between frames and only grows, and
+// long runs of text can be referenced where they are instead of copied: they go out together
+// with the copied bytes in one writev
+struct abufPiece {
+    const char *ext; // NULL when the piece is a range of b
+    int off; // start in b when ext is NULL
+    int len;
+};
+
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+    struct abufPiece *pieces;
+    int npieces;
+    int piecesCap;
+    int sealed; // bytes of b already covered by pieces
+};
+// empty buffer
+#define ABUF_INIT {NULL, 0, 0, NULL, 0, 0, 0}
+
+// one open file and everything about it: its rows, where the cursor and the view are, its
+// undo history and swap journal. switching buffers is swapping the B pointer
+struct editorBuffer {
     int coordX, coordY;
     int renderX; // bc can't assume a character takes up only one column
     int rowOffset;
     int colOffset;
+    struct editorSyntax *syntax; // points into E.syntax, shared by every buffer of the filetype
+    int numrows;
+    rowNode *rows;
+    int rowMaxLeaves; // leaf count at the last full rebuild, deletes rebalance against it
+    rowNode *rowCacheLeaf; // last leaf looked up, so walking rows in order stays O(1)
+    int rowCacheStart; // index of the first row in rowCacheLeaf
+    int hlFrontier; // rows below this have an up to date hl_open_comment
+    int hlScanned; // rows below this have had their state computed at least once
+    char *map; // read-only mapping of the opened file, rows point into it until edited
+    size_t mapSize;
+    volatile sig_atomic_t mapLost; // pages past the file's new end were faulted in as zeros
+    char *filename;
+    dev_t dev; // identity of the file on disk, so opening it again finds this buffer
+    ino_t ino;
+    int crlf; // the file ended its rows with \r\n, they are written back that way
+    int mixedEnds; // some rows ended with \r\n and some with \n, they are written with \n
+    int noFinalNewline; // the last row had no newline, nor does it get one when written
+    char *undoLog; // journal of undoOps back to back, oldest first
+    size_t undoLen; // bytes in use, including undone ops kept for redo
+    size_t undoCap;
+    size_t undoTop; // end of the last op applied, ops from here on are redo history
+    long undoLast; // header of the last op applied, -1 for none
+    int undoGroup;
+    unsigned long undoSerial; // bumped per op recorded, a keypress that records none ends a run
+    int undoBroken; // the next edit starts a new group
+    struct editorJournal journal;
+    struct editorFollow follow;
+    int isDirty;
+};
+
+// state of the editor as a whole: the terminal, what is on screen, and what all buffers share
+struct editorConfig {
     int screenrows;
     int screencols;
-    struct editorSyntax *syntax;
     struct termios orig_termios;
-    int numrows;
-    erow *row;
-    char *filename;
+    struct editorBuffer **buffers; // open buffers, in the order they were opened
+    int nbuffers;
+    int current; // index of B in buffers
+    long pageSize; // for the SIGBUS handler, which cannot ask
+    // rendered rows of every buffer, a slot belongs to whichever row holds its gen
+    struct rowRender *renderCache;
+    int renderCacheSize;
+    int renderHead, renderTail;
     char statusmsg[80];
     time_t statusmsg_time;
-    int isDirty;
+    struct screenFrame frame; // frame being drawn
+    struct screenFrame prevFrame; // what the terminal currently shows
+    struct abuf frameBuf; // output arena, reused every frame
+    struct searchIndex search;
+    int prompting; // a prompt is reading keys, the buffer holds still until it closes
+    struct editorLoop loop;
+    int frameValid; // prevFrame matches the terminal
+    int frameRowOffset; // rowOffset prevFrame was drawn at
+    size_t frameBytes; // bytes written for the last frame
+    unsigned long long totalFrameBytes;
+    unsigned long frames;
+    struct syntaxTable syntax; // loaded before any file is opened
+    struct editorPerf perf;
 };
 
 // Filetypes
@@ -124,7 +553,8 @@ struct editorSyntax HL_DB[] = {
         C_HL_extensions,
         C_HL_keywords,
         "//", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+        NULL
     },
 };
 
@@ -133,6 +563,10 @@ struct editorSyntax HL_DB[] = {
 
 // global variable state
 struct editorConfig E;
+__thread struct editorBuffer *B; // the buffer being edited, batch workers each have their own
+// where row chars and render buffers are allocated. per thread like B, so batch workers never
+// share a free list
+__thread struct slabArena Slab;
 
 
 // TERMINAL CONTROL
@@ -146,8 +580,28 @@ void editorSetStatusMessage(const char *fmt, ...) {
 }
 
 void editorRefreshScreen();
-
-char *editorPrompt(char *prompt, void(*callback)(char *, int));
+void editorScroll();
+ssize_t writevAll(int fd, struct iovec *iov, int n);
+
+void editorSyntaxIdle();
+void editorRunParallel(void *(*pass)(void *), void *tasks, size_t size, int ntasks);
+int editorFollowPoll();
+void journalReport();
+void editorMapReport();
+void editorFrameInit();
+void editorRenderCacheInit(int slots);
+void editorBufferAdd();
+void editorBufferClose();
+struct abuf;
+void abAppend(struct abuf *ab, const char*s, int len);
+void abFree(struct abuf *ab);
+ssize_t abWrite(struct abuf *ab, int fd);
+
+int editorRowCoordXtoRenderX(int filerow, int coordX);
+int editorRowOutState(int filerow);
+int editorRowRenderXToCoordX(int filerow, int renderX);
+
+char *editorPrompt(char *prompt, void(*callback)(char *, int), int allowEmpty);
 
 // kill program on error
 void end(const char *s) {
@@ -163,6 +617,7 @@ void end(const char *s) {
 
 // turn off raw mode when user exits program
 void disableRawMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
         end("tcsetattr");
     }
@@ -184,92 +639,523 @@ void enableRawMode() {
     //turn off output processing
     raw.c_oflag &= ~(OPOST);
 
-    // min number of bytes of input before read can return
+    // read never waits, the event loop polls for input instead
     raw.c_cc[VMIN] = 0;
-    // max amount of time before read returns. returns 0 on timeout
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
         end("tcsetattr");
     }
+    // have pastes bracketed, so they arrive as text rather than keystrokes
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey() {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            end("read");
+// PERF
+// spans are timed around reading and handling a key, painting a frame and writing a file, and
+// rows restyled are counted and timed inside them. a key's latency runs from the read that
+// brought it in to the end of the frame that shows it. ^T puts the last one and the p99 of
+// the last PERF_LATENCIES in the status bar, with the frame's bytes and the rows restyled.
+// with -t every span goes to a file in the JSON array form of the Chrome trace format, which
+// chrome://tracing and Perfetto open: latencies on a track of their own, the spans nest on the
+// editor's
+
+long long editorNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void perfTimingUpdate() {
+    E.perf.timing = E.perf.overlay || E.perf.trace;
+}
+
+struct perfSpan perfBegin() {
+    struct perfSpan span = { 0, E.perf.rowsStyled, E.perf.styleNs };
+    if (E.perf.timing) {
+        span.start = editorNowNs();
+    }
+    return span;
+}
+
+// write out the events held. the array is left open until perfTraceEnd, viewers take it either way
+void perfTraceFlush() {
+    if (!E.perf.trace || E.perf.nevents == 0) {
+        return;
+    }
+    struct abuf ab = ABUF_INIT;
+    char buf[320];
+    int pid = getpid();
+    for (int j = 0; j < E.perf.nevents; j++) {
+        struct perfEvent *e = &E.perf.events[j];
+        int latency = e->name == NULL;
+        int len = snprintf(buf, sizeof(buf),
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"bytes\":%lld,\"rows restyled\":%llu,\"style us\":%.3f}}",
+                E.perf.written++ ? ",\n" : "", latency ? "key to paint" : e->name, (e->start - E.perf.epoch) / 1e3,
+                e->dur / 1e3, pid, latency ? 2 : 1, e->bytes, e->rows, e->styleNs / 1e3);
+        abAppend(&ab, buf, len);
+    }
+    if (abWrite(&ab, E.perf.trace) == -1) {
+        close(E.perf.trace); // the trace is cut short, the session goes on
+        E.perf.trace = 0;
+        perfTimingUpdate();
+    }
+    abFree(&ab);
+    E.perf.nevents = 0;
+}
+
+// the end of a span: an event for the trace. name NULL is a key-to-paint latency
+void perfEvent(const char *name, long long start, long long end, long long bytes, unsigned long long rows,
+        long long styleNs) {
+    if (!E.perf.trace) {
+        return;
+    }
+    E.perf.events[E.perf.nevents++] = (struct perfEvent) { name, start, end - start, bytes, rows, styleNs };
+    if (E.perf.nevents == TRACE_EVENTS) {
+        perfTraceFlush();
+    }
+}
+
+void perfEnd(const char *name, struct perfSpan *span, long long bytes) {
+    if (span->start) {
+        perfEvent(name, span->start, editorNowNs(), bytes, E.perf.rowsStyled - span->rows,
+                E.perf.styleNs - span->styleNs);
+    }
+}
+
+// rows were styled, or had their end state worked out, timed from start when that is not 0
+void perfStyled(int rows, long long start) {
+    if (!E.perf.timing) {
+        return;
+    }
+    E.perf.rowsStyled += rows;
+    if (start) {
+        E.perf.styleNs += editorNowNs() - start;
+    }
+}
+
+// a key is about to be handled
+void perfKeyRead() {
+    if (E.perf.timing && E.perf.keyAt == 0) {
+        E.perf.keyAt = E.perf.readAt ? E.perf.readAt : editorNowNs();
+        E.perf.keyRows = E.perf.rowsStyled;
+        E.perf.keyStyleNs = E.perf.styleNs;
+    }
+}
+
+// into the ring, and into sorted in place of the one it pushes out of the ring
+void perfLatencyAdd(long long ns) {
+    int n = E.perf.nlatency < PERF_LATENCIES ? E.perf.nlatency : PERF_LATENCIES;
+    long long *sorted = E.perf.sorted;
+    long long *slot = &E.perf.latency[E.perf.nlatency++ % PERF_LATENCIES];
+    if (n == PERF_LATENCIES) {
+        int k = 0;
+        while (sorted[k] != *slot) {
+            k++;
+        }
+        memmove(&sorted[k], &sorted[k + 1], sizeof(long long) * (--n - k));
+    }
+    *slot = ns;
+    int k = n;
+    for (; k > 0 && sorted[k - 1] > ns; k--) {
+        sorted[k] = sorted[k - 1];
+    }
+    sorted[k] = ns;
+}
+
+// a frame is on the terminal, the keys read since the last one are painted
+void perfPainted() {
+    if (E.perf.keyAt == 0) {
+        return;
+    }
+    long long now = editorNowNs();
+    perfLatencyAdd(now - E.perf.keyAt);
+    E.perf.lastRows = E.perf.rowsStyled - E.perf.keyRows;
+    perfEvent(NULL, E.perf.keyAt, now, E.frameBytes, E.perf.lastRows, E.perf.styleNs - E.perf.keyStyleNs);
+    E.perf.keyAt = 0;
+}
+
+void perfTraceEnd() {
+    perfTraceFlush();
+    if (E.perf.trace) {
+        write(E.perf.trace, "\n]\n", 3);
+        close(E.perf.trace);
+        E.perf.trace = 0;
+    }
+}
+
+// start the trace in path, named tracks first. returns -1 if it can't be created
+int perfTraceStart(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    char buf[256];
+    int pid = getpid();
+    int len = snprintf(buf, sizeof(buf),
+            "[{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,\"args\":{\"name\":\"editor\"}},\n"
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":2,\"args\":{\"name\":\"key to paint\"}}",
+            pid, pid);
+    if (write(fd, buf, len) != len) {
+        close(fd);
+        return -1;
+    }
+    E.perf.trace = fd;
+    E.perf.written = 1;
+    E.perf.events = malloc(sizeof(struct perfEvent) * TRACE_EVENTS);
+    E.perf.epoch = editorNowNs();
+    perfTimingUpdate();
+    atexit(perfTraceEnd);
+    return 0;
+}
+
+// the p99 of the latencies kept
+long long perfLatencyP99() {
+    int n = E.perf.nlatency < PERF_LATENCIES ? E.perf.nlatency : PERF_LATENCIES;
+    return n ? E.perf.sorted[(n - 1) * 99 / 100] : 0;
+}
+
+// EVENT LOOP
+// the editor sleeps in poll on the terminal, a self-pipe and the followed file's inotify
+// descriptor, with a timeout set by the nearest timer. input is read in bulk into a ring and
+// keys are decoded from there, an escape sequence split across reads waits for its tail.
+// SIGWINCH and worker threads wake the loop by writing a byte to the pipe
+
+long long editorNowMs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// wake the event loop. safe from a signal handler and from any thread
+void editorWake(char why) {
+    if (!E.loop.ready) {
+        return;
+    }
+    int saved_errno = errno;
+    if (write(E.loop.wake[1], &why, 1) == -1) {
+        // the pipe is full, the loop has wake-ups enough to read
+    }
+    errno = saved_errno;
+}
+
+void editorHandleWinch(int sig) {
+    (void) sig;
+    editorWake(WAKE_RESIZE);
+}
+
+void editorLoopInit() {
+    if (pipe2(E.loop.wake, O_NONBLOCK | O_CLOEXEC) == -1) {
+        end("pipe");
+    }
+    E.loop.head = E.loop.tail = 0;
+    E.loop.escSince = 0;
+    E.loop.taskDone = 0;
+    E.loop.ready = 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleWinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+// take the new window size. the frame is reallocated and repainted whole, the render cache
+// only ever grows so rows keep their slots
+void editorHandleResize() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 || ws.ws_row < 3) {
+        return;
+    }
+    E.screenrows = ws.ws_row - 2;
+    E.screencols = ws.ws_col;
+    editorRenderCacheInit(E.screenrows * RENDER_CACHE_SCREENS);
+    editorFrameInit();
+}
+
+int editorInputCount() {
+    return E.loop.tail - E.loop.head;
+}
+
+int editorInputAt(int i) {
+    return (unsigned char) E.loop.ring[(E.loop.head + i) & (INPUT_RING_SIZE - 1)];
+}
+
+// read all waiting input into the ring, both free runs in one readv
+void editorInputFill() {
+    unsigned int room = INPUT_RING_SIZE - editorInputCount();
+    if (room == 0) {
+        return;
+    }
+    unsigned int at = E.loop.tail & (INPUT_RING_SIZE - 1);
+    unsigned int first = INPUT_RING_SIZE - at < room ? INPUT_RING_SIZE - at : room;
+    struct iovec iov[2] = {
+        { &E.loop.ring[at], first },
+        { E.loop.ring, room - first },
+    };
+    ssize_t n = readv(STDIN_FILENO, iov, room > first ? 2 : 1);
+    if (n == -1 && errno != EAGAIN && errno != EINTR) {
+        end("read");
+    }
+    if (n > 0) {
+        if (E.loop.record) {
+            iov[0].iov_len = (size_t) n < first ? (size_t) n : first;
+            iov[1].iov_len = n - iov[0].iov_len;
+            if (writevAll(E.loop.record, iov, iov[1].iov_len ? 2 : 1) == -1) {
+                E.loop.record = 0; // the recording is cut short, the session goes on
+            }
+        }
+        E.loop.tail += n;
+        if (E.perf.timing) {
+            E.perf.readAt = editorNowNs();
+        }
+    }
+}
+
+// ESC [ params final, with used set to its length. returns 0 while it is still arriving
+int editorParseCsi(int n, int *key, int *used) {
+    int param = 0, i = 2;
+    while (i < n && i < ESC_SEQ_MAX) {
+        int c = editorInputAt(i++);
+        if (c >= '0' && c <= '9') {
+            param = param * 10 + c - '0';
+        } else if (c == ';') {
+            param = 0; // only the last parameter matters, modifiers are ignored
+        } else if (c >= 0x40 && c <= 0x7e) {
+            *used = i;
+            switch (c) {
+                case 'A': *key = ARROW_UP; break;
+                case 'B': *key = ARROW_DOWN; break;
+                case 'C': *key = ARROW_RIGHT; break;
+                case 'D': *key = ARROW_LEFT; break;
+                case 'H': *key = HOME_KEY; break;
+                case 'F': *key = END_KEY; break;
+                case '~':
+                    switch (param) {
+                        case 1: case 7: *key = HOME_KEY; break;
+                        case 4: case 8: *key = END_KEY; break;
+                        case 3: *key = DEL_KEY; break;
+                        case 5: *key = PAGE_UP; break;
+                        case 6: *key = PAGE_DOWN; break;
+                        case 200: *key = PASTE_BEGIN; break;
+                    }
+                    break;
+            }
+            return 1;
         }
     }
+    if (i >= ESC_SEQ_MAX) {
+        *used = 1; // not a sequence after all, the ESC stands alone
+        return 1;
+    }
+    return 0;
+}
 
-    if (c == '\x1b') {
-        char seq[3];
+// decode the key at the front of the ring. returns -1 when there is none yet, including while
+// an escape sequence may still be on its way
+int editorParseKey() {
+    int n = editorInputCount();
+    if (n == 0) {
+        return -1;
+    }
+    int c = editorInputAt(0);
+    int key = c, used = 1, complete = 1;
+
+    if (c == '\x1b' && n == 1) {
+        complete = 0;
+    } else if (c == '\x1b') {
+        int next = editorInputAt(1);
+        if (next == '[') {
+            complete = editorParseCsi(n, &key, &used);
+        } else if (next == 'O') {
+            complete = n >= 3;
+            if (complete) {
+                used = 3;
+                key = editorInputAt(2) == 'H' ? HOME_KEY : editorInputAt(2) == 'F' ? END_KEY : '\x1b';
+            }
+        }
+    }
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-            return '\x1b';
+    if (!complete) {
+        long long now = editorNowMs(CLOCK_MONOTONIC);
+        if (E.loop.escSince == 0) {
+            E.loop.escSince = now;
+        }
+        if (now - E.loop.escSince < ESC_TIMEOUT_MS) {
+            return -1;
         }
+        used = n; // what came of the sequence goes with the ESC
+        key = '\x1b';
+    }
+    E.loop.escSince = 0;
+    E.loop.head += used;
+    return key;
+}
+
+// sleep until input, a wake-up or the nearest timer, then service whatever is due. the
+// screen is refreshed when something other than a key changed it
+void editorWaitEvents() {
+    struct pollfd fds[3] = {
+        { STDIN_FILENO, POLLIN, 0 },
+        { E.loop.wake[0], POLLIN, 0 },
+        { B->follow.watch, POLLIN, 0 },
+    };
+    int following = B->follow.on && !E.prompting;
+    int nfds = following && B->follow.fd != -1 ? 3 : 2;
 
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-            return '\x1b';
+    // the nearest timer bounds the wait
+    long long timeout = -1;
+    if (B->syntax && B->hlFrontier < B->numrows) {
+        timeout = 0; // restyle in slices between looks at the input
+    }
+    if (E.loop.escSince) {
+        long long left = E.loop.escSince + ESC_TIMEOUT_MS - editorNowMs(CLOCK_MONOTONIC);
+        timeout = (timeout == -1 || left < timeout) ? (left > 0 ? left : 0) : timeout;
+    }
+    if (following && B->follow.fd == -1 && (timeout == -1 || timeout > FOLLOW_RETRY_MS)) {
+        timeout = FOLLOW_RETRY_MS;
+    }
+    long long expiry = -1;
+    if (E.statusmsg[0] && !E.prompting) {
+        expiry = (long long) (E.statusmsg_time + STATUS_MSG_SECONDS) * 1000 - editorNowMs(CLOCK_REALTIME);
+        if (timeout == -1 || expiry < timeout) {
+            timeout = expiry > 0 ? expiry : 0;
         }
+    }
+
+    int ready = poll(fds, nfds, timeout);
+    if (ready == -1 && errno != EINTR) {
+        end("poll");
+    }
+    int redraw = 0;
 
-        if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) {
-                    return '\x1b';
+    if (fds[0].revents & POLLIN) {
+        editorInputFill();
+    } else if (fds[0].revents & (POLLHUP | POLLERR)) {
+        end("read"); // the terminal is gone, any swap file stays for recovery
+    }
+    if (fds[1].revents & POLLIN) {
+        char why[64];
+        ssize_t n;
+        while ((n = read(E.loop.wake[0], why, sizeof(why))) > 0) {
+            for (ssize_t j = 0; j < n; j++) {
+                if (why[j] == WAKE_RESIZE) {
+                    editorHandleResize();
+                    redraw = 1;
+                } else if (why[j] == WAKE_TASK) {
+                    E.loop.taskDone = 1;
                 }
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1':
-                            return HOME_KEY;
-                        case '3':
-                            return DEL_KEY;
-                        case '4':
-                            return END_KEY;
-                        case '5':
-                            return PAGE_UP;
-                        case '6':
-                            return PAGE_DOWN;
-                        case '7':
-                            return HOME_KEY;
-                        case '8':
-                            return END_KEY;
-                    }
+            }
+        }
+    }
+    if ((nfds > 2 && (fds[2].revents & POLLIN)) || (following && B->follow.fd == -1)) {
+        redraw |= editorFollowPoll();
+    }
+    if (E.loop.taskDone) {
+        journalReport();
+        editorMapReport();
+        // an open prompt hears of it as a key, see editorReadKey
+        if (!E.prompting) {
+            E.loop.taskDone = 0;
+            redraw = 1;
+        }
+    }
+    if (expiry != -1 && expiry <= 0) {
+        E.statusmsg[0] = '\0';
+        redraw = 1;
+    }
+    if (ready == 0) {
+        editorSyntaxIdle();
+    }
+    if (redraw) {
+        editorRefreshScreen();
+    }
+}
+
+// a whole key is waiting in the ring
+int editorKeyPending() {
+    unsigned int head = E.loop.head;
+    long long escSince = E.loop.escSince;
+    int key = editorParseKey();
+    E.loop.head = head;
+    E.loop.escSince = escSince;
+    return key != -1;
+}
+
+int editorReadKey() {
+    while (1) {
+        int key = editorParseKey();
+        if (key != -1) {
+            perfKeyRead();
+            return key;
+        }
+        if (E.prompting && E.loop.taskDone) {
+            E.loop.taskDone = 0;
+            return TASK_DONE;
+        }
+        editorWaitEvents();
+    }
+}
+
+// the input at i starts with s
+int editorInputMatches(int i, const char *s) {
+    for (; *s; s++, i++) {
+        if (editorInputAt(i) != (unsigned char) *s) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// collect the text of a bracketed paste, PASTE_BEGIN having been read, up to its end marker.
+// line breaks come as \r or \r\n and are stored as \n. the text is taken straight from the
+// ring as it fills, without decoding keys
+void editorReadPaste(struct abuf *ab) {
+    int cr = 0; // the last byte was a \r, a \n right after it is the same break
+    while (1) {
+        int n = editorInputCount();
+        int i = 0;
+        for (; i < n; i++) {
+            int c = editorInputAt(i);
+            if (c == '\x1b') {
+                if (n - i < (int) sizeof(PASTE_END) - 1) {
+                    break; // the marker may be arriving
                 }
-            } else {
-                switch (seq[1]) {
-                    case 'A':
-                        return ARROW_UP;
-                    case 'B':
-                        return ARROW_DOWN;
-                    case 'C':
-                        return ARROW_RIGHT;
-                    case 'D':
-                        return ARROW_LEFT;
-                    case 'H':
-                        return HOME_KEY;
-                    case 'F':
-                        return END_KEY;
+                if (editorInputMatches(i, PASTE_END)) {
+                    E.loop.head += i + sizeof(PASTE_END) - 1;
+                    return;
                 }
             }
-        } else if (seq[0] == '0') {
-            switch (seq[1]) {
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
+            if (c == '\n' && cr) {
+                cr = 0;
+                continue;
             }
+            cr = c == '\r';
+            char ch = cr ? '\n' : c;
+            abAppend(ab, &ch, 1);
+        }
+        E.loop.head += i;
+
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&pfd, 1, PASTE_TIMEOUT_MS) != 1) {
+            return;
+        }
+        int before = editorInputCount();
+        editorInputFill();
+        if (editorInputCount() == before) {
+            return; // input closed mid paste
         }
-        
-        return '\x1b';
-    } else {
-        return c;
     }
 }
 
+// typed characters that can go in as text, as opposed to keys with a meaning
+int editorIsTyped(int c) {
+    return c == '\t' || (c >= 32 && c < 256 && c != BACKSPACE);
+}
+
 int getCursorPosition(int *rows, int *cols) {
     char buf[32];
     unsigned int i = 0;
@@ -279,7 +1165,8 @@ int getCursorPosition(int *rows, int *cols) {
     }
 
     while (i < sizeof(buf) -1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) {
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&pfd, 1, ESC_TIMEOUT_MS) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1) {
             break;
         }
         if (buf[i] == 'R') {
@@ -319,123 +1206,672 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
-// Sytanx-styles
+// ROW STORE
 
-// check if character is space, null byte, or certain special character
-int is_separator(int c) {
-    return isspace(c) || c =='\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+rowNode *rowLeafNew() {
+    rowNode *leaf = calloc(1, sizeof(rowNode));
+    leaf->rows = malloc(sizeof(erow) * ROW_LEAF_SIZE);
+    leaf->leaves = 1;
+    return leaf;
 }
 
-void editorSyntaxStyle(erow *row) {
-    row->highlight = realloc(row->highlight, row->renderSize);
-    
-    // set all characters to highlight normal by default
-    memset(row->highlight, HL_NORMAL, row->renderSize);
-    if (E.syntax == NULL) return; // if no filetype, return immediately
+erow *editorRowAt(int at) {
+    rowNode *leaf = B->rowCacheLeaf;
+    if (leaf && at >= B->rowCacheStart && at < B->rowCacheStart + leaf->count) {
+        return &leaf->rows[at - B->rowCacheStart];
+    }
 
-    char **keywords = E.syntax->keywords;
+    rowNode *node = B->rows;
+    int start = 0;
+    while (node->left) {
+        if (at < node->left->count) {
+            node = node->left;
+        } else {
+            start += node->left->count;
+            at -= node->left->count;
+            node = node->right;
+        }
+    }
+    B->rowCacheLeaf = node;
+    B->rowCacheStart = start;
+    return &node->rows[at];
+}
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+// list the leaves under node in order, leaving the tree as it is
+void rowTreeListLeaves(rowNode *node, rowNode **out, int *n) {
+    if (node->left == NULL) {
+        out[(*n)++] = node;
+        return;
+    }
+    rowTreeListLeaves(node->left, out, n);
+    rowTreeListLeaves(node->right, out, n);
+}
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+void rowTreeCollectLeaves(rowNode *node, rowNode **out, int *n) {
+    if (node->left == NULL) {
+        out[(*n)++] = node;
+        return;
+    }
+    rowTreeCollectLeaves(node->left, out, n);
+    rowTreeCollectLeaves(node->right, out, n);
+    free(node);
+}
 
-    int prev_sep = 1; // default to true
-    int in_string = 0; // tracks if we are currently in a string
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment); // check if in ml comment
+rowNode *rowTreeBuild(rowNode **leaves, int lo, int hi) {
+    if (hi - lo == 1) {
+        return leaves[lo];
+    }
+    int mid = lo + (hi - lo) / 2;
+    rowNode *node = calloc(1, sizeof(rowNode));
+    node->left = rowTreeBuild(leaves, lo, mid);
+    node->right = rowTreeBuild(leaves, mid, hi);
+    node->count = node->left->count + node->right->count;
+    node->leaves = node->left->leaves + node->right->leaves;
+    return node;
+}
 
-    int i = 0;
-    while (i < row->renderSize) {
-        char c = row->render[i];
-        unsigned char prev_highlight = (i > 0) ? row->highlight[i - 1] : HL_NORMAL;
+// flatten a subtree into its leaves and rebuild it perfectly balanced (scapegoat rebuild)
+void rowTreeRebuild(rowNode **slot) {
+    rowNode **leaves = malloc(sizeof(rowNode *) * (*slot)->leaves);
+    int n = 0;
+    rowTreeCollectLeaves(*slot, leaves, &n);
+    *slot = rowTreeBuild(leaves, 0, n);
+    free(leaves);
+}
 
-        if (scs_len && !in_string && !in_comment) {
-            // strncmp -> check and compare first character of the strings
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->highlight[i], HL_COMMENT, row->renderSize - 1);
-                break;
+// a subtree is unbalanced when one side holds more than 70% of its leaves
+int rowTreeUnbalanced(rowNode *node) {
+    int heavy = node->left->leaves > node->right->leaves ? node->left->leaves : node->right->leaves;
+    return heavy * 10 > node->leaves * 7;
+}
+
+int rowTreeDepthLimit(int leaves) {
+    int limit = 1;
+    double reach = 1;
+    while (reach < leaves) {
+        reach /= 0.7;
+        limit++;
+    }
+    return limit;
+}
+
+// insert a copy of row at index at
+void rowTreeInsert(int at, erow *row) {
+    if (B->rows == NULL) {
+        B->rows = rowLeafNew();
+        B->rowMaxLeaves = 1;
+    }
+    B->rowCacheLeaf = NULL;
+
+    rowNode **path[ROW_TREE_MAX_DEPTH];
+    int depth = 0;
+    rowNode **slot = &B->rows;
+
+    while ((*slot)->left) {
+        rowNode *node = *slot;
+        path[depth++] = slot;
+        node->count++;
+        if (at <= node->left->count) {
+            slot = &node->left;
+        } else {
+            at -= node->left->count;
+            slot = &node->right;
+        }
+    }
+
+    rowNode *leaf = *slot;
+    if (leaf->count < ROW_LEAF_SIZE) {
+        memmove(&leaf->rows[at + 1], &leaf->rows[at], sizeof(erow) * (leaf->count - at));
+        leaf->rows[at] = *row;
+        leaf->count++;
+        return;
+    }
+
+    // full leaf: split it in two, the old node becomes their parent
+    int half = ROW_LEAF_SIZE / 2;
+    rowNode *lo = calloc(1, sizeof(rowNode));
+    rowNode *hi = rowLeafNew();
+    lo->rows = leaf->rows;
+    lo->leaves = 1;
+    lo->count = half;
+    hi->count = ROW_LEAF_SIZE - half;
+    memcpy(hi->rows, &lo->rows[half], sizeof(erow) * hi->count);
+
+    rowNode *target = (at <= half) ? lo : hi;
+    int pos = (at <= half) ? at : at - half;
+    memmove(&target->rows[pos + 1], &target->rows[pos], sizeof(erow) * (target->count - pos));
+    target->rows[pos] = *row;
+    target->count++;
+
+    leaf->rows = NULL;
+    leaf->left = lo;
+    leaf->right = hi;
+    leaf->count = ROW_LEAF_SIZE + 1;
+    leaf->leaves = 2;
+    path[depth++] = slot;
+
+    for (int d = 0; d < depth - 1; d++) {
+        (*path[d])->leaves++;
+    }
+
+    if (B->rows->leaves > B->rowMaxLeaves) {
+        B->rowMaxLeaves = B->rows->leaves;
+    }
+    if (depth + 1 > rowTreeDepthLimit(B->rows->leaves)) {
+        // walk back up to the lowest unbalanced ancestor and rebuild from there
+        for (int d = depth - 1; d >= 0; d--) {
+            if (rowTreeUnbalanced(*path[d])) {
+                rowTreeRebuild(path[d]);
+                break;
+            }
+        }
+    }
+}
+
+// remove the row at index at, the caller frees what it owns
+void rowTreeDelete(int at) {
+    B->rowCacheLeaf = NULL;
+
+    rowNode **path[ROW_TREE_MAX_DEPTH];
+    int depth = 0;
+    rowNode **slot = &B->rows;
+
+    while ((*slot)->left) {
+        rowNode *node = *slot;
+        path[depth++] = slot;
+        node->count--;
+        if (at < node->left->count) {
+            slot = &node->left;
+        } else {
+            at -= node->left->count;
+            slot = &node->right;
+        }
+    }
+
+    rowNode *leaf = *slot;
+    memmove(&leaf->rows[at], &leaf->rows[at + 1], sizeof(erow) * (leaf->count - at - 1));
+    leaf->count--;
+
+    if (depth == 0) {
+        return;
+    }
+
+    // fold a thin leaf into a leaf sibling, or drop it once empty
+    rowNode **parentSlot = path[depth - 1];
+    rowNode *parent = *parentSlot;
+    rowNode *sibling = (parent->left == leaf) ? parent->right : parent->left;
+    int merge = sibling->left == NULL && leaf->count + sibling->count <= ROW_LEAF_SIZE / 2;
+    if (leaf->count > 0 && !merge) {
+        return;
+    }
+
+    if (merge && leaf->count > 0) {
+        if (parent->left == leaf) {
+            memmove(&sibling->rows[leaf->count], sibling->rows, sizeof(erow) * sibling->count);
+            memcpy(sibling->rows, leaf->rows, sizeof(erow) * leaf->count);
+        } else {
+            memcpy(&sibling->rows[sibling->count], leaf->rows, sizeof(erow) * leaf->count);
+        }
+        sibling->count += leaf->count;
+    }
+
+    *parentSlot = sibling;
+    free(leaf->rows);
+    free(leaf);
+    free(parent);
+    for (int d = 0; d < depth - 1; d++) {
+        (*path[d])->leaves--;
+    }
+
+    if (B->rows->leaves * 10 < B->rowMaxLeaves * 7) {
+        rowTreeRebuild(&B->rows);
+        B->rowMaxLeaves = B->rows->leaves;
+    }
+}
+
+// remove the first count rows, the caller frees what they own. whole leaves are let go and the
+// tree is rebuilt over the rest, so trimming a long history is a pass over the leaves rather
+// than a delete per row
+void rowTreeDropFront(int count) {
+    B->rowCacheLeaf = NULL;
+    rowNode **leaves = malloc(sizeof(rowNode *) * B->rows->leaves);
+    int n = 0;
+    rowTreeCollectLeaves(B->rows, leaves, &n);
+
+    int first = 0;
+    while (first < n && count >= leaves[first]->count) {
+        count -= leaves[first]->count;
+        free(leaves[first]->rows);
+        free(leaves[first]);
+        first++;
+    }
+    if (first < n) {
+        rowNode *leaf = leaves[first];
+        memmove(leaf->rows, &leaf->rows[count], sizeof(erow) * (leaf->count - count));
+        leaf->count -= count;
+        B->rows = rowTreeBuild(leaves, first, n);
+        B->rowMaxLeaves = B->rows->leaves;
+    } else {
+        B->rows = NULL;
+        B->rowMaxLeaves = 0;
+    }
+    free(leaves);
+}
+
+// ROW ALLOCATOR
+// row chars and render buffers come from size-classed slabs: powers of two from 16 bytes to
+// 4KB, carved out of large chunks and recycled through a free list per class, so millions of
+// rows cost a few hundred mallocs rather than millions. a block's capacity doubles as it grows,
+// so typing reallocates once per power of two. bigger blocks go to malloc, still doubling
+
+int slabCapFor(int need) {
+    int cap = 1 << SLAB_MIN_SHIFT;
+    while (cap < need) {
+        cap *= 2;
+    }
+    return cap;
+}
+
+int slabClassOf(int cap) {
+    int cls = 0;
+    while ((1 << (cls + SLAB_MIN_SHIFT)) < cap) {
+        cls++;
+    }
+    return cls < SLAB_CLASSES ? cls : -1;
+}
+
+// a block of at least need bytes, its real size goes in *cap
+char *slabAlloc(int need, int *cap) {
+    if (Slab.useMalloc) {
+        *cap = need;
+        return malloc(need);
+    }
+
+    *cap = slabCapFor(need);
+    int cls = slabClassOf(*cap);
+    if (cls == -1) {
+        return malloc(*cap);
+    }
+
+    struct slabClass *sc = &Slab.classes[cls];
+    if (sc->freeList) {
+        void *block = sc->freeList;
+        sc->freeList = *(void **) block;
+        return block;
+    }
+    if (sc->next == sc->end) {
+        if (Slab.nchunks == Slab.chunksCap) {
+            Slab.chunksCap = Slab.chunksCap ? Slab.chunksCap * 2 : 16;
+            Slab.chunks = realloc(Slab.chunks, sizeof(char *) * Slab.chunksCap);
+        }
+        sc->next = malloc(SLAB_CHUNK_BYTES);
+        sc->end = sc->next + SLAB_CHUNK_BYTES;
+        Slab.chunks[Slab.nchunks++] = sc->next;
+    }
+    char *block = sc->next;
+    sc->next += *cap;
+    return block;
+}
+
+void slabFree(char *block, int cap) {
+    if (block == NULL) {
+        return;
+    }
+    int cls = slabClassOf(cap);
+    if (Slab.useMalloc || cls == -1) {
+        free(block);
+        return;
+    }
+    *(void **) block = Slab.classes[cls].freeList;
+    Slab.classes[cls].freeList = block;
+}
+
+// grow a block to hold need bytes, keeping its first keep bytes
+char *slabGrow(char *block, int *cap, int need, int keep) {
+    if (Slab.useMalloc) {
+        *cap = need;
+        return realloc(block, need);
+    }
+    if (need <= *cap) {
+        return block;
+    }
+    int newCap;
+    char *grown = slabAlloc(need, &newCap);
+    memcpy(grown, block, keep);
+    slabFree(block, *cap);
+    *cap = newCap;
+    return grown;
+}
+
+// hand every chunk back. only when no row or render buffer is left in them
+void slabReset(int useMalloc) {
+    for (int j = 0; j < Slab.nchunks; j++) {
+        free(Slab.chunks[j]);
+    }
+    free(Slab.chunks);
+    memset(&Slab, 0, sizeof(Slab));
+    Slab.useMalloc = useMalloc;
+}
+
+// RENDER CACHE
+
+void editorRenderUnlink(int slot) {
+    struct rowRender *rr = &E.renderCache[slot];
+    if (rr->prev != -1) {
+        E.renderCache[rr->prev].next = rr->next;
+    } else {
+        E.renderHead = rr->next;
+    }
+    if (rr->next != -1) {
+        E.renderCache[rr->next].prev = rr->prev;
+    } else {
+        E.renderTail = rr->prev;
+    }
+}
+
+void editorRenderPushHead(int slot) {
+    struct rowRender *rr = &E.renderCache[slot];
+    rr->prev = -1;
+    rr->next = E.renderHead;
+    if (E.renderHead != -1) {
+        E.renderCache[E.renderHead].prev = slot;
+    }
+    E.renderHead = slot;
+    if (E.renderTail == -1) {
+        E.renderTail = slot;
+    }
+}
+
+void editorRenderPushTail(int slot) {
+    struct rowRender *rr = &E.renderCache[slot];
+    rr->next = -1;
+    rr->prev = E.renderTail;
+    if (E.renderTail != -1) {
+        E.renderCache[E.renderTail].next = slot;
+    }
+    E.renderTail = slot;
+    if (E.renderHead == -1) {
+        E.renderHead = slot;
+    }
+}
+
+// size the cache for at least slots rows. it never shrinks, rows hold on to slot indices
+void editorRenderCacheInit(int slots) {
+    if (slots < RENDER_CACHE_MIN_ROWS) {
+        slots = RENDER_CACHE_MIN_ROWS;
+    }
+    if (slots <= E.renderCacheSize) {
+        return;
+    }
+    E.renderCache = realloc(E.renderCache, sizeof(struct rowRender) * slots);
+    memset(&E.renderCache[E.renderCacheSize], 0, sizeof(struct rowRender) * (slots - E.renderCacheSize));
+    if (E.renderCacheSize == 0) {
+        E.renderHead = E.renderTail = -1;
+    }
+    for (int j = E.renderCacheSize; j < slots; j++) {
+        editorRenderPushTail(j);
+    }
+    E.renderCacheSize = slots;
+}
+
+struct rowRender *editorRowCached(erow *row) {
+    if (row->renderSlot < 0 || E.renderCache[row->renderSlot].gen != row->renderGen) {
+        return NULL;
+    }
+    return &E.renderCache[row->renderSlot];
+}
+
+// give the row a slot of its own, recycling the least recently used one if it has none
+struct rowRender *editorRenderAcquire(erow *row) {
+    int slot;
+    if (editorRowCached(row)) {
+        slot = row->renderSlot;
+    } else {
+        slot = E.renderTail;
+        E.renderCache[slot].gen++;
+        row->renderSlot = slot;
+        row->renderGen = E.renderCache[slot].gen;
+    }
+    editorRenderUnlink(slot);
+    editorRenderPushHead(slot);
+    return &E.renderCache[slot];
+}
+
+// drop a row's render after its chars change, its slot is the next one recycled
+void editorRowInvalidate(erow *row) {
+    struct rowRender *rr = editorRowCached(row);
+    if (rr) {
+        rr->gen++;
+        editorRenderUnlink(row->renderSlot);
+        editorRenderPushTail(row->renderSlot);
+    }
+    row->renderSlot = -1;
+}
+
+void editorRenderCacheClear() {
+    for (int j = 0; j < E.renderCacheSize; j++) {
+        E.renderCache[j].gen++;
+    }
+}
+
+// Sytanx-styles
+
+// check if character is space, null byte, or certain special character
+int is_separator(int c) {
+    return isspace(c) || c =='\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+struct keywordTrie *editorKeywordCompile(char **keywords) {
+    struct keywordTrie *t = calloc(1, sizeof(struct keywordTrie));
+    int maxNodes = 1;
+    t->classes = 1;
+
+    for (int j = 0; keywords[j]; j++) {
+        int len = strlen(keywords[j]);
+        if (len && keywords[j][len - 1] == '|') {
+            len--;
+        }
+        maxNodes += len;
+        for (int k = 0; k < len; k++) {
+            unsigned char c = keywords[j][k];
+            if (t->classOf[c] == 0) {
+                t->classOf[c] = t->classes++;
+            }
+        }
+    }
+
+    t->next = calloc((size_t) maxNodes * t->classes, sizeof(int));
+    t->match = calloc(maxNodes, 1);
+    t->nodes = 1;
+
+    for (int j = 0; keywords[j]; j++) {
+        int len = strlen(keywords[j]);
+        int keywords2 = len && keywords[j][len - 1] == '|';
+        if (keywords2) {
+            len--;
+        }
+
+        int node = 0;
+        for (int k = 0; k < len; k++) {
+            int *edge = &t->next[node * t->classes + t->classOf[(unsigned char) keywords[j][k]]];
+            if (*edge == 0) {
+                *edge = t->nodes++;
+            }
+            node = *edge;
+        }
+        if (t->match[node] == 0) {
+            t->match[node] = keywords2 ? HL_KEYWORD_2 : HL_KEYWORD_1;
+        }
+    }
+    return t;
+}
+
+void editorKeywordFree(struct keywordTrie *t) {
+    free(t->next);
+    free(t->match);
+    free(t);
+}
+
+// match a whole keyword at the start of s: it has to be followed by a separator or the end of
+// the row. returns HL_KEYWORD_1/2 and its length, or 0
+int editorKeywordMatch(struct keywordTrie *t, const char *s, int len, int *matchLen) {
+    int node = 0;
+    for (int i = 0; i < len; i++) {
+        int class = t->classOf[(unsigned char) s[i]];
+        if (class == 0 || (node = t->next[node * t->classes + class]) == 0) {
+            return 0;
+        }
+        if (t->match[node] && (i + 1 == len || is_separator(s[i + 1]))) {
+            *matchLen = i + 1;
+            return t->match[node];
+        }
+    }
+    return 0;
+}
+
+// the styling state at the start of a row
+struct hlState editorSyntaxStart(int in_comment) {
+    struct hlState st = { 0 };
+    st.in_comment = in_comment;
+    st.prev_sep = 1;
+    return st;
+}
+
+// style text[from, to), size bytes in all, carrying on from st and leaving in st the state at
+// to. tokens starting before to may look and reach past it, what they take past it is the
+// carry. hl may be NULL to only follow the state along, else it is already HL_NORMAL
+void editorSyntaxRun(struct editorSyntax *syntax, const char *text, int size, int from, int to, unsigned char *hl, struct hlState *st) {
+    if (st->line_comment) {
+        if (hl) {
+            memset(&hl[from], HL_COMMENT, to - from);
+        }
+        return;
+    }
+
+    struct keywordTrie *keywords = syntax->keywordTrie;
+
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int in_comment = st->in_comment;
+    int in_string = st->in_string; // tracks if we are currently in a string
+    int prev_sep = st->prev_sep;
+    int prev_number = st->prev_number;
+    int token_hl = st->carry_hl; // highlight of the last token, for what of it lies past to
+
+    int i = from;
+    if (st->carry) {
+        if (hl) {
+            memset(&hl[i], token_hl, st->carry < to - i ? st->carry : to - i);
+        }
+        i += st->carry;
+    }
+    while (i < to) {
+        char c = text[i];
+        int after_number = prev_number;
+        prev_number = 0;
+
+        if (scs_len && !in_string && !in_comment) {
+            if (i + scs_len <= size && !memcmp(&text[i], scs, scs_len)) {
+                if (hl) {
+                    memset(&hl[i], HL_COMMENT, to - i);
+                }
+                st->line_comment = 1;
+                i = to;
+                break;
             }
         }
 
         if (mcs_len && mce_len && !in_string) {
             if (in_comment) {
-                row->highlight[i] = HL_ML_COMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->highlight[i], HL_ML_COMMENT, mce_len);
+                token_hl = HL_ML_COMMENT;
+                if (i + mce_len <= size && !memcmp(&text[i], mce, mce_len)) {
+                    if (hl) {
+                        memset(&hl[i], HL_ML_COMMENT, i + mce_len < to ? mce_len : to - i);
+                    }
                     i += mce_len;
                     in_comment = 0;
                     prev_sep = 1;
-                    continue;
                 } else {
+                    if (hl) {
+                        hl[i] = HL_ML_COMMENT;
+                    }
                     i++;
-                    continue;
                 }
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->highlight[i], HL_ML_COMMENT, mcs_len);
+                continue;
+            } else if (i + mcs_len <= size && !memcmp(&text[i], mcs, mcs_len)) {
+                if (hl) {
+                    memset(&hl[i], HL_ML_COMMENT, i + mcs_len < to ? mcs_len : to - i);
+                }
+                token_hl = HL_ML_COMMENT;
                 i += mcs_len;
                 in_comment = 1;
                 continue;
             }
         }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+        if (syntax->flags & HL_HIGHLIGHT_STRINGS) {
             if (in_string) {
-                row->highlight[i] = HL_STRING;
+                token_hl = HL_STRING;
+                if (hl) {
+                    hl[i] = HL_STRING;
+                }
 
-                if (c == '\\' && i + 1 < row->renderSize) {
-                    row->highlight[i + 1] = HL_STRING;
+                if (c == '\\' && i + 1 < size) {
+                    if (hl && i + 1 < to) {
+                        hl[i + 1] = HL_STRING;
+                    }
                     i += 2;
                     continue;
                 }
 
                 if (c == in_string) {
                     in_string = 0;
-                } 
+                }
                 i++;
                 prev_sep = 1;
                 continue;
             } else {
                 if (c == '"' || c == '\'') {
                     in_string = c;
-                    row->highlight[i] = HL_STRING;
+                    if (hl) {
+                        hl[i] = HL_STRING;
+                    }
                     i++;
                     continue;
                 }
             }
         }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) { // check if numbers should be highlighted for the given filetype 
-            if ((isdigit(c) && (prev_sep || prev_highlight == HL_NUMBER)) || (c == '.' && prev_highlight == HL_NUMBER)) {
-                row->highlight[i] = HL_NUMBER;
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) { // check if numbers should be highlighted for the given filetype 
+            if ((isdigit(c) && (prev_sep || after_number)) || (c == '.' && after_number)) {
+                if (hl) {
+                    hl[i] = HL_NUMBER;
+                }
                 i++;
                 prev_sep = 0;
+                prev_number = 1;
                 continue;
             }
         }
 
         if (prev_sep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int keywordLen = strlen(keywords[j]);
-                int keywords2 = keywords[j][keywordLen - 1] == '|';
-
-                if (keywords2) {
-                    keywordLen--;
-                }
-
-                if (!strncmp(&row->render[i], keywords[j], keywordLen) && is_separator(row->render[i + keywordLen])) {
-                    memset(&row->highlight[i], keywords2 ? HL_KEYWORD_2 : HL_KEYWORD_1, keywordLen);
+            int keywordLen;
+            int keyword = editorKeywordMatch(keywords, &text[i], size - i, &keywordLen);
 
-                    i += keywordLen;
-                    break;
-                }
-                if (keywords[j] != NULL) {
-                    prev_sep = 0;
-                    continue;
+            if (keyword) {
+                if (hl) {
+                    memset(&hl[i], keyword, i + keywordLen < to ? keywordLen : to - i);
                 }
+                token_hl = keyword;
+                i += keywordLen;
+                prev_sep = 0;
+                continue;
             }
         }
 
@@ -444,534 +1880,4541 @@ void editorSyntaxStyle(erow *row) {
         i++;
     }
 
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.numrows) {
-        editorSyntaxStyle(&E.row[row->idx + 1]);
-    }
+    st->in_comment = in_comment;
+    st->in_string = in_string;
+    st->prev_sep = prev_sep;
+    st->prev_number = prev_number;
+    st->carry = i - to;
+    st->carry_hl = st->carry ? token_hl : 0;
 }
 
-int editorSyntaxColoring(int highlight) {
-    switch(highlight) {
-        case HL_COMMENT:
-        case HL_ML_COMMENT:
-            return 36;
-        case HL_STRING:
-            return 35;
-        case HL_MATCH: 
-            return 34;
-        case HL_KEYWORD_1:
-            return 33;
-        case HL_KEYWORD_2:
-            return 32;
-        case HL_NUMBER: 
-            return 31;
-        default:
-            return 37;
-    }
+// style one rendered row given the comment state it starts in, returns the state it ends in
+int editorSyntaxStyle(struct rowRender *rr, int in_comment) {
+    // set all characters to highlight normal by default
+    memset(rr->highlight, HL_NORMAL, rr->renderSize);
+    if (B->syntax == NULL) return 0; // if no filetype, return immediately
+
+    long long start = E.perf.timing ? editorNowNs() : 0;
+    struct hlState st = editorSyntaxStart(in_comment);
+    editorSyntaxRun(B->syntax, rr->render, rr->renderSize, 0, rr->renderSize, rr->highlight, &st);
+    perfStyled(1, start);
+    return st.in_comment;
 }
 
-void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if (E.filename == NULL) return;
+// the comment state at the end of a row without styling it. follows the same transitions as
+// editorSyntaxStyle (keywords and numbers never open or close anything), but runs on chars
+// directly so rows off screen never need a render
+int editorSyntaxState(struct editorSyntax *syntax, const char *chars, int size, int in_comment) {
+    if (syntax == NULL) return 0;
 
-    // strrchr -> returns pointer to the last occurence of a character in a string
-    char *ext = strrchr(E.filename, '.');
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
 
-    for (unsigned int j = 0; j < HL_DB_ENTRIES; j++) {
-        struct editorSyntax *s = &HL_DB[j];
-        unsigned int i = 0;
-
-        while (s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            
-            // strcmp -> returns 0 if two strings are equal
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || !(is_ext && strstr(E.filename, s->filematch[i]))) {
-                E.syntax = s;
-
-                int filerow;
-                // loop through rows in a file and apply syntax highlight
-                for (filerow = 0; filerow < E.numrows; filerow++) {
-                    editorSyntaxStyle(&E.row[filerow]);
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+    int strings = syntax->flags & HL_HIGHLIGHT_STRINGS;
+
+    int in_string = 0;
+    int i = 0;
+    while (i < size) {
+        char c = chars[i];
+
+        if (scs_len && !in_string && !in_comment) {
+            if (i + scs_len <= size && !memcmp(&chars[i], scs, scs_len)) {
+                break;
+            }
+        }
+
+        if (mcs_len && mce_len && !in_string) {
+            if (in_comment) {
+                if (i + mce_len <= size && !memcmp(&chars[i], mce, mce_len)) {
+                    i += mce_len;
+                    in_comment = 0;
+                } else {
+                    i++;
                 }
+                continue;
+            } else if (i + mcs_len <= size && !memcmp(&chars[i], mcs, mcs_len)) {
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
 
-                return;
+        if (strings) {
+            if (in_string) {
+                if (c == '\\' && i + 1 < size) {
+                    i += 2;
+                    continue;
+                }
+                if (c == in_string) {
+                    in_string = 0;
+                }
+            } else if (c == '"' || c == '\'') {
+                in_string = c;
             }
-            i++;
         }
+        i++;
     }
+    return in_comment;
 }
 
-// ROWS
+int editorRowInState(int filerow) {
+    return (filerow > 0 && editorRowAt(filerow - 1)->hl_open_comment);
+}
 
-void editorUpdateRow(erow *row) {
-    int tabs = 0;
-    int j;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            tabs++;
-        }
-    }
+// the state row filerow ends in, scanned from the one it starts in. counted as a row restyled
+int editorRowScanState(int filerow) {
+    if (B->syntax == NULL) return 0;
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(TAB_LENGTH_STOP - 1) + 1); // max num of characters needed for tab (8)
+    erow *row = editorRowAt(filerow);
+    long long start = E.perf.timing ? editorNowNs() : 0;
+    int out = editorSyntaxState(B->syntax, row->chars, row->size, editorRowInState(filerow));
+    perfStyled(1, start);
+    return out;
+}
 
-    int idx = 0;
-    for(j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % TAB_LENGTH_STOP != 0) {
-                row->render[idx++] = ' ';
-            }
-        } else {
-            row->render[idx++] = row->chars[j];
+// bring hl_open_comment up to date for every row above target. rows between the frontier and
+// hlScanned still hold one consistent run of states from before, so as soon as a row ends in
+// the same state it did then, everything up to hlScanned is known good again
+void editorSyntaxCatchUp(int target) {
+    if (target > B->numrows) {
+        target = B->numrows;
+    }
+    while (B->hlFrontier < target) {
+        int r = B->hlFrontier;
+        erow *row = editorRowAt(r);
+        int out = editorRowScanState(r);
+        int same = (out == row->hl_open_comment);
+
+        // a cached highlight was built from whatever state was current then
+        editorRowInvalidate(row);
+        row->hl_open_comment = out;
+        B->hlFrontier++;
+
+        if (same && B->hlFrontier < B->hlScanned) {
+            B->hlFrontier = B->hlScanned;
+        }
+        if (B->hlScanned < B->hlFrontier) {
+            B->hlScanned = B->hlFrontier;
         }
     }
-    row->render[idx] = '\0';
-    row->renderSize = idx;
-
-    editorSyntaxStyle(row);
 }
 
-void editorAppendRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.numrows) {
-        return;
+// a row's chars changed: carry its new end state down the file. rows are restyled one at a
+// time until one ends in the state it ended in before. only rows through the bottom of the
+// screen are done now, the frontier is pulled back to where we stopped and the rest is
+// caught up lazily
+void editorSyntaxPropagate(int filerow) {
+    int stop = B->rowOffset + E.screenrows;
+    if (stop <= filerow) {
+        stop = filerow + 1;
     }
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-
-    for (int j = at + 1; j <= E.numrows; j++) {
-        E.row[j].idx++;
+    for (int r = filerow; r < B->hlFrontier; r++) {
+        if (r >= stop) {
+            // rows from here to the old frontier keep a consistent run of old states, but the
+            // run past the old frontier may have started from a different state
+            B->hlScanned = B->hlFrontier;
+            B->hlFrontier = r;
+            return;
+        }
+        erow *row = editorRowAt(r);
+        int out = (r == filerow) ? editorRowOutState(r) : editorRowScanState(r);
+        if (r > filerow) {
+            editorRowInvalidate(row);
+        }
+        if (out == row->hl_open_comment) {
+            return;
+        }
+        row->hl_open_comment = out;
+    }
+}
+
+// catch up in small steps while waiting for input
+void editorSyntaxIdle() {
+    if (B->syntax && B->hlFrontier < B->numrows) {
+        editorSyntaxCatchUp(B->hlFrontier + HL_IDLE_ROWS);
+    }
+}
+
+// one run of leaves for editorSyntaxScan, scanned from an assumed starting state
+struct hlChunk {
+    struct editorSyntax *syntax;
+    rowNode **leaves;
+    int from, to; // leaf range
+    int in; // state the chunk was scanned from
+    int out; // state at the end of its last row
+};
+
+void *editorSyntaxScanChunk(void *arg) {
+    struct hlChunk *c = arg;
+    int state = c->in;
+    for (int l = c->from; l < c->to; l++) {
+        rowNode *leaf = c->leaves[l];
+        for (int j = 0; j < leaf->count; j++) {
+            erow *row = &leaf->rows[j];
+            state = editorSyntaxState(c->syntax, row->chars, row->size, state);
+            row->hl_open_comment = state;
+        }
+    }
+    c->out = state;
+    return NULL;
+}
+
+// the comment state of every row at once, right after a load. a row's state only depends on
+// the row above, so the rows are cut into one chunk per thread and each chunk is scanned as if
+// no comment were open where it starts. then the chunks are walked in order: where the state
+// really coming in differs, the chunk is rescanned from its top until a row ends in the state
+// it was given speculatively, from there on the speculative states are right. threads 0 means
+// one per CPU
+void editorSyntaxScan(int threads) {
+    if (B->syntax == NULL || B->numrows == 0) {
+        return;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : cpus;
+    }
+    if (threads > LOAD_MAX_THREADS) {
+        threads = LOAD_MAX_THREADS;
+    }
+
+    int nleaves = 0;
+    rowNode **leaves = malloc(sizeof(rowNode *) * B->rows->leaves);
+    rowTreeListLeaves(B->rows, leaves, &nleaves);
+    if (threads > nleaves) {
+        threads = nleaves;
+    }
+
+    long long start = E.perf.timing ? editorNowNs() : 0;
+    int rescanned = 0;
+    struct hlChunk chunks[LOAD_MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        chunks[t].syntax = B->syntax;
+        chunks[t].leaves = leaves;
+        chunks[t].from = (long long) nleaves * t / threads;
+        chunks[t].to = (long long) nleaves * (t + 1) / threads;
+        chunks[t].in = 0;
+    }
+    editorRunParallel(editorSyntaxScanChunk, chunks, sizeof(struct hlChunk), threads);
+
+    for (int t = 1; t < threads; t++) {
+        struct hlChunk *c = &chunks[t];
+        int state = chunks[t - 1].out;
+        if (state == c->in) {
+            continue;
+        }
+        int settled = 0;
+        for (int l = c->from; l < c->to && !settled; l++) {
+            rowNode *leaf = leaves[l];
+            for (int j = 0; j < leaf->count; j++) {
+                erow *row = &leaf->rows[j];
+                state = editorSyntaxState(c->syntax, row->chars, row->size, state);
+                rescanned++;
+                if (state == row->hl_open_comment) {
+                    settled = 1;
+                    break;
+                }
+                row->hl_open_comment = state;
+            }
+        }
+        if (!settled) {
+            c->out = state;
+        }
+    }
+    free(leaves);
+    // the workers cannot count, every row was scanned once by one of them
+    perfStyled(B->numrows + rescanned, start);
+
+    // anything rendered so far was styled from the old states
+    editorRenderCacheClear();
+    B->hlFrontier = B->numrows;
+    B->hlScanned = B->numrows;
+}
+
+// state pass for a freshly loaded buffer: all at once on every core when the file is big,
+// otherwise the frontier catches up as the rows are drawn
+void editorSyntaxLoaded() {
+    if (B->numrows >= HL_PARALLEL_MIN_ROWS) {
+        editorSyntaxScan(0);
+    }
+}
+
+int editorSyntaxColoring(int highlight) {
+    switch(highlight) {
+        case HL_COMMENT:
+        case HL_ML_COMMENT:
+            return 36;
+        case HL_STRING:
+            return 35;
+        case HL_MATCH: 
+            return 34;
+        case HL_KEYWORD_1:
+            return 33;
+        case HL_KEYWORD_2:
+            return 32;
+        case HL_NUMBER: 
+            return 31;
+        default:
+            return 37;
+    }
+}
+
+// SYNTAX FILES
+// the built-in HL_DB and every *.syntax file in the syntax directory are compiled into one
+// image: the strings, each filetype's keyword DFA and a hash of extensions and file names.
+// the image is written to SYNTAX_CACHE in the directory, and later starts map it as it is for
+// as long as the definition files are the ones it was compiled from. a definition file holds
+// a directive and its words per line, # starts a comment line:
+//
+//     filetype python
+//     match .py .pyw SConstruct
+//     keywords if elif else while for return def class
+//     types int str float bool
+//     comment #
+//     block """ """
+//     highlight numbers strings
+
+unsigned int syntaxHash(const char *s, int len, unsigned int h) {
+    for (int j = 0; j < len; j++) {
+        h = (h ^ (unsigned char) s[j]) * 16777619u;
+    }
+    return h;
+}
+
+// the next blank separated word at *p, NULL at the end of the line
+char *syntaxWord(char **p, int *len) {
+    while (**p == ' ' || **p == '\t') {
+        (*p)++;
+    }
+    if (**p == '\0') {
+        return NULL;
+    }
+    char *word = *p;
+    while (**p != '\0' && **p != ' ' && **p != '\t') {
+        (*p)++;
+    }
+    *len = *p - word;
+    return word;
+}
+
+// a copy of word with suffix after it, added to a NULL terminated list
+char **syntaxListAdd(char **list, const char *word, int len, const char *suffix) {
+    int n = 0;
+    while (list && list[n]) {
+        n++;
+    }
+    list = realloc(list, sizeof(char *) * (n + 2));
+    int suffixLen = strlen(suffix);
+    list[n] = malloc(len + suffixLen + 1);
+    memcpy(list[n], word, len);
+    memcpy(list[n] + len, suffix, suffixLen + 1);
+    list[n + 1] = NULL;
+    return list;
+}
+
+void syntaxListFree(char **list) {
+    for (int j = 0; list && list[j]; j++) {
+        free(list[j]);
+    }
+    free(list);
+}
+
+void syntaxDefFree(struct editorSyntax *s) {
+    free(s->filetype);
+    syntaxListFree(s->filematch);
+    syntaxListFree(s->keywords);
+    free(s->singleline_comment_start);
+    free(s->multiline_comment_start);
+    free(s->multiline_comment_end);
+    memset(s, 0, sizeof(*s));
+}
+
+// one line of a definition file into s. returns 0, or -1 with *err saying what is wrong
+int syntaxParseDirective(char *p, struct editorSyntax *s, const char **err) {
+    int len, len2;
+    char *directive = syntaxWord(&p, &len);
+    char *word = NULL;
+    if (len == 8 && !strncmp(directive, "filetype", len)) {
+        if ((word = syntaxWord(&p, &len)) == NULL || syntaxWord(&p, &len2)) {
+            *err = "expected filetype NAME";
+            return -1;
+        }
+        free(s->filetype);
+        s->filetype = strndup(word, len);
+    } else if (len == 5 && !strncmp(directive, "match", len)) {
+        while ((word = syntaxWord(&p, &len))) {
+            s->filematch = syntaxListAdd(s->filematch, word, len, "");
+        }
+    } else if ((len == 8 && !strncmp(directive, "keywords", len)) || (len == 5 && !strncmp(directive, "types", len))) {
+        const char *suffix = len == 5 ? "|" : "";
+        while ((word = syntaxWord(&p, &len))) {
+            s->keywords = syntaxListAdd(s->keywords, word, len, suffix);
+        }
+    } else if (len == 7 && !strncmp(directive, "comment", len)) {
+        if ((word = syntaxWord(&p, &len)) == NULL || syntaxWord(&p, &len2)) {
+            *err = "expected comment START";
+            return -1;
+        }
+        free(s->singleline_comment_start);
+        s->singleline_comment_start = strndup(word, len);
+    } else if (len == 5 && !strncmp(directive, "block", len)) {
+        char *end;
+        if ((word = syntaxWord(&p, &len)) == NULL || (end = syntaxWord(&p, &len2)) == NULL || syntaxWord(&p, &len)) {
+            *err = "expected block START END";
+            return -1;
+        }
+        free(s->multiline_comment_start);
+        free(s->multiline_comment_end);
+        s->multiline_comment_start = strndup(word, len);
+        s->multiline_comment_end = strndup(end, len2);
+    } else if (len == 9 && !strncmp(directive, "highlight", len)) {
+        while ((word = syntaxWord(&p, &len))) {
+            if (len == 7 && !strncmp(word, "numbers", len)) {
+                s->flags |= HL_HIGHLIGHT_NUMBERS;
+            } else if (len == 7 && !strncmp(word, "strings", len)) {
+                s->flags |= HL_HIGHLIGHT_STRINGS;
+            } else {
+                *err = "expected highlight numbers and/or strings";
+                return -1;
+            }
+        }
+    } else {
+        *err = "unknown directive";
+        return -1;
+    }
+    return 0;
+}
+
+// read one definition file into s. returns -1 with what is wrong with it in msg
+int syntaxParseFile(const char *path, struct editorSyntax *s, char *msg, int msglen) {
+    memset(s, 0, sizeof(*s));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        snprintf(msg, msglen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int lineno = 0, ok = 1;
+    while (ok && (linelen = getline(&line, &linecap, fp)) != -1) {
+        lineno++;
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+            line[--linelen] = '\0';
+        }
+        char *p = line;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        const char *err;
+        if (syntaxParseDirective(p, s, &err) == -1) {
+            snprintf(msg, msglen, "%s:%d: %s", path, lineno, err);
+            ok = 0;
+        }
+    }
+    free(line);
+    fclose(fp);
+    if (ok && s->filetype == NULL) {
+        snprintf(msg, msglen, "%s: no filetype", path);
+        ok = 0;
+    }
+    if (!ok) {
+        syntaxDefFree(s);
+    }
+    return ok ? 0 : -1;
+}
+
+struct syntaxImageBuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+// append len bytes of data, zeros if it is NULL, at a multiple of align. returns their offset
+int syntaxImagePut(struct syntaxImageBuf *ib, const void *data, int len, int align) {
+    int at = (ib->len + align - 1) / align * align;
+    if (at + len > ib->cap) {
+        int cap = ib->cap ? ib->cap : 4096;
+        while (cap < at + len) {
+            cap *= 2;
+        }
+        ib->b = realloc(ib->b, cap);
+        ib->cap = cap;
+    }
+    memset(&ib->b[ib->len], 0, at - ib->len);
+    if (data) {
+        memcpy(&ib->b[at], data, len);
+    } else {
+        memset(&ib->b[at], 0, len);
+    }
+    ib->len = at + len;
+    return at;
+}
+
+int syntaxImageString(struct syntaxImageBuf *ib, const char *str) {
+    return str ? syntaxImagePut(ib, str, strlen(str) + 1, 1) : 0;
+}
+
+// compile defs into an image, in *size bytes. a later def takes an extension or a file name
+// over from an earlier one
+char *syntaxCompile(struct editorSyntax *defs, int ndefs, unsigned long long fingerprint, int *size) {
+    struct syntaxImageBuf ib = { NULL, 0, 0 };
+    syntaxImagePut(&ib, NULL, sizeof(struct syntaxImageHeader), 8);
+
+    int patterns = 0;
+    for (int j = 0; j < ndefs; j++) {
+        for (int k = 0; defs[j].filematch && defs[j].filematch[k]; k++) {
+            patterns++;
+        }
+    }
+    int slots = 16;
+    while (slots < 2 * patterns) {
+        slots *= 2;
+    }
+    int syntaxOff = syntaxImagePut(&ib, NULL, sizeof(struct syntaxImageEntry) * ndefs, 4);
+    int slotsOff = syntaxImagePut(&ib, NULL, sizeof(struct syntaxImageSlot) * slots, 4);
+
+    for (int j = 0; j < ndefs; j++) {
+        struct syntaxImageEntry e;
+        e.filetype = syntaxImageString(&ib, defs[j].filetype);
+        e.scs = syntaxImageString(&ib, defs[j].singleline_comment_start);
+        e.mcs = syntaxImageString(&ib, defs[j].multiline_comment_start);
+        e.mce = syntaxImageString(&ib, defs[j].multiline_comment_end);
+        e.flags = defs[j].flags;
+
+        char *none[] = { NULL };
+        struct keywordTrie *t = editorKeywordCompile(defs[j].keywords ? defs[j].keywords : none);
+        e.classes = t->classes;
+        e.nodes = t->nodes;
+        e.classOf = syntaxImagePut(&ib, t->classOf, sizeof(t->classOf), 1);
+        e.next = syntaxImagePut(&ib, t->next, sizeof(int) * t->nodes * t->classes, 4);
+        e.match = syntaxImagePut(&ib, t->match, t->nodes, 1);
+        editorKeywordFree(t);
+        memcpy(&ib.b[syntaxOff + sizeof(e) * j], &e, sizeof(e));
+
+        for (int k = 0; defs[j].filematch && defs[j].filematch[k]; k++) {
+            const char *key = defs[j].filematch[k];
+            unsigned int h = syntaxHash(key, strlen(key), 2166136261u);
+            int i = h & (slots - 1);
+            struct syntaxImageSlot *slot;
+            while ((slot = (struct syntaxImageSlot *) &ib.b[slotsOff] + i)->key && (slot->hash != h || strcmp(&ib.b[slot->key], key))) {
+                i = (i + 1) & (slots - 1);
+            }
+            if (slot->key == 0) {
+                int keyOff = syntaxImageString(&ib, key);
+                slot = (struct syntaxImageSlot *) &ib.b[slotsOff] + i; // the image may have moved
+                slot->hash = h;
+                slot->key = keyOff;
+            }
+            slot->syntax = j;
+        }
+    }
+
+    struct syntaxImageHeader *h = (struct syntaxImageHeader *) ib.b;
+    memcpy(h->magic, SYNTAX_MAGIC, sizeof(h->magic));
+    h->fingerprint = fingerprint;
+    h->size = ib.len;
+    h->nsyntax = ndefs;
+    h->syntaxOff = syntaxOff;
+    h->slots = slots;
+    h->slotsOff = slotsOff;
+    *size = ib.len;
+    return ib.b;
+}
+
+void syntaxTableFree() {
+    struct syntaxTable *t = &E.syntax;
+    if (t->mapped) {
+        munmap(t->image, t->size);
+    } else {
+        free(t->image);
+    }
+    free(t->syntaxes);
+    free(t->tries);
+    memset(t, 0, sizeof(*t));
+}
+
+// an offset of len bytes that lies within an image of size bytes
+int syntaxImageHas(int size, long long off, long long len) {
+    return off >= 0 && len >= 0 && off + len <= size;
+}
+
+// make image the syntax table, once it is checked to hang together. returns -1 if it does
+// not, the table is left as it was
+int syntaxUseImage(char *image, int size, int mapped) {
+    struct syntaxImageHeader *h = (struct syntaxImageHeader *) image;
+    if (size < (int) sizeof(*h) || memcmp(h->magic, SYNTAX_MAGIC, sizeof(h->magic)) || h->size != size ||
+            !syntaxImageHas(size, h->syntaxOff, (long long) sizeof(struct syntaxImageEntry) * h->nsyntax) ||
+            h->slots <= 0 || (h->slots & (h->slots - 1)) ||
+            !syntaxImageHas(size, h->slotsOff, (long long) sizeof(struct syntaxImageSlot) * h->slots)) {
+        return -1;
+    }
+    struct syntaxImageEntry *entries = (struct syntaxImageEntry *) &image[h->syntaxOff];
+    for (int j = 0; j < h->nsyntax; j++) {
+        struct syntaxImageEntry *e = &entries[j];
+        if (!syntaxImageHas(size, e->classOf, 256) || !syntaxImageHas(size, e->match, e->nodes) ||
+                !syntaxImageHas(size, e->next, (long long) sizeof(int) * e->nodes * e->classes) ||
+                e->filetype <= 0 || e->filetype >= size || e->scs < 0 || e->scs >= size || e->mcs < 0 ||
+                e->mcs >= size || e->mce < 0 || e->mce >= size || e->classes < 1 || e->classes > 256 || e->nodes < 1) {
+            return -1;
+        }
+        // a cache is read back as it was written, but a damaged one must not send a keyword
+        // match outside the tables
+        for (int c = 0; c < 256; c++) {
+            if ((unsigned char) image[e->classOf + c] >= e->classes) {
+                return -1;
+            }
+        }
+        int *next = (int *) &image[e->next];
+        for (long long k = 0; k < (long long) e->nodes * e->classes; k++) {
+            if (next[k] < 0 || next[k] >= e->nodes) {
+                return -1;
+            }
+        }
+    }
+    struct syntaxImageSlot *slots = (struct syntaxImageSlot *) &image[h->slotsOff];
+    int empty = 0;
+    for (int j = 0; j < h->slots; j++) {
+        empty += slots[j].key == 0;
+        if (slots[j].key && (slots[j].key < 0 || slots[j].key >= size || slots[j].syntax < 0 || slots[j].syntax >= h->nsyntax)) {
+            return -1;
+        }
+    }
+    if (empty == 0 || image[size - 1] != '\0') {
+        return -1; // a lookup ends at an empty slot, the strings end within the image
+    }
+
+    syntaxTableFree();
+    struct syntaxTable *t = &E.syntax;
+    t->image = image;
+    t->size = size;
+    t->mapped = mapped;
+    t->nsyntax = h->nsyntax;
+    t->syntaxes = calloc(h->nsyntax ? h->nsyntax : 1, sizeof(struct editorSyntax));
+    t->tries = calloc(h->nsyntax ? h->nsyntax : 1, sizeof(struct keywordTrie));
+    for (int j = 0; j < h->nsyntax; j++) {
+        struct syntaxImageEntry *e = &entries[j];
+        struct keywordTrie *trie = &t->tries[j];
+        memcpy(trie->classOf, &image[e->classOf], sizeof(trie->classOf));
+        trie->classes = e->classes;
+        trie->nodes = e->nodes;
+        trie->next = (int *) &image[e->next];
+        trie->match = (unsigned char *) &image[e->match];
+
+        struct editorSyntax *s = &t->syntaxes[j];
+        s->filetype = &image[e->filetype];
+        s->singleline_comment_start = e->scs ? &image[e->scs] : NULL;
+        s->multiline_comment_start = e->mcs ? &image[e->mcs] : NULL;
+        s->multiline_comment_end = e->mce ? &image[e->mce] : NULL;
+        s->flags = e->flags;
+        s->keywordTrie = trie;
+    }
+    return 0;
+}
+
+int syntaxCompareNames(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// the definition files in dir, sorted and NULL terminated, with their names, sizes and times added into
+// *fingerprint. NULL if dir can't be read
+char **syntaxDirFiles(const char *dir, int *n, unsigned long long *fingerprint) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return NULL;
+    }
+    char **files = NULL;
+    int cap = 0;
+    *n = 0;
+    struct dirent *ent;
+    int suffixLen = strlen(SYNTAX_SUFFIX);
+    while ((ent = readdir(d))) {
+        int len = strlen(ent->d_name);
+        struct stat st;
+        if (len <= suffixLen || strcmp(&ent->d_name[len - suffixLen], SYNTAX_SUFFIX) ||
+                fstatat(dirfd(d), ent->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (*n + 1 >= cap) {
+            cap = cap ? cap * 2 : 16;
+            files = realloc(files, sizeof(char *) * cap);
+        }
+        files[(*n)++] = strdup(ent->d_name);
+        long long stamp[3] = { st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+        unsigned int h = syntaxHash(ent->d_name, len, 2166136261u);
+        h = syntaxHash((const char *) stamp, sizeof(stamp), h);
+        *fingerprint += (unsigned long long) h * 2654435761u + *n; // the same whatever order they are read in
+    }
+    closedir(d);
+    if (files == NULL) {
+        return calloc(1, sizeof(char *));
+    }
+    files[*n] = NULL;
+    qsort(files, *n, sizeof(char *), syntaxCompareNames);
+    return files;
+}
+
+// the built-in definitions go into the fingerprint too, a cache from another build is stale
+unsigned long long syntaxBuiltinFingerprint() {
+    unsigned int h = 2166136261u;
+    for (unsigned int j = 0; j < HL_DB_ENTRIES; j++) {
+        struct editorSyntax *s = &HL_DB[j];
+        char *strings[] = { s->filetype, s->singleline_comment_start, s->multiline_comment_start, s->multiline_comment_end };
+        for (int k = 0; k < 4; k++) {
+            h = strings[k] ? syntaxHash(strings[k], strlen(strings[k]) + 1, h) : syntaxHash("", 0, h * 31);
+        }
+        for (int k = 0; s->filematch[k]; k++) {
+            h = syntaxHash(s->filematch[k], strlen(s->filematch[k]) + 1, h);
+        }
+        for (int k = 0; s->keywords[k]; k++) {
+            h = syntaxHash(s->keywords[k], strlen(s->keywords[k]) + 1, h);
+        }
+        h = syntaxHash((const char *) &s->flags, sizeof(s->flags), h);
+    }
+    return (unsigned long long) h << 32;
+}
+
+// write the image through a temporary file renamed over the cache, so a start reading it
+// meanwhile maps the old one or the new one. it is only a cache, so failing to write it is
+// left at that and it is not synced
+void syntaxWriteCache(const char *path, char *image, int size) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        return;
+    }
+    struct iovec iov = { image, size };
+    int ok = writevAll(fd, &iov, 1) == size;
+    if (close(fd) == -1) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, path) == -1) {
+        unlink(tmp);
+    }
+}
+
+// load the syntax definitions, the built-in ones and those in dir, from the cache there while
+// it is current. a NULL dir, or one that can't be read, is the built-in ones only. returns -1
+// with what was wrong in msg when a definition file could not be used, the rest are loaded
+int editorSyntaxLoad(const char *dir, char *msg, int msglen) {
+    unsigned long long fingerprint = syntaxBuiltinFingerprint();
+    int nfiles = 0;
+    char **files = dir ? syntaxDirFiles(dir, &nfiles, &fingerprint) : NULL;
+    char cache[PATH_MAX];
+    if (files) {
+        snprintf(cache, sizeof(cache), "%s/%s", dir, SYNTAX_CACHE);
+        int fd = open(cache, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(struct syntaxImageHeader) && st.st_size < INT_MAX) {
+            char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED && ((struct syntaxImageHeader *) map)->fingerprint == fingerprint &&
+                    syntaxUseImage(map, st.st_size, 1) == 0) {
+                close(fd);
+                syntaxListFree(files);
+                return 0;
+            }
+            if (map != MAP_FAILED) {
+                munmap(map, st.st_size);
+            }
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // the built-in ones first, so a definition file can take their extensions over
+    struct editorSyntax *defs = calloc(HL_DB_ENTRIES + nfiles, sizeof(struct editorSyntax));
+    memcpy(defs, HL_DB, sizeof(HL_DB));
+    int ndefs = HL_DB_ENTRIES, ok = 1;
+    for (int j = 0; j < nfiles; j++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, files[j]);
+        if (syntaxParseFile(path, &defs[ndefs], msg, msglen) == 0) {
+            ndefs++;
+        } else if (ok) {
+            ok = 0;
+            msglen = 0; // the first error is the one reported
+        }
+    }
+    int size;
+    char *image = syntaxCompile(defs, ndefs, fingerprint, &size);
+    for (int j = HL_DB_ENTRIES; j < ndefs; j++) {
+        syntaxDefFree(&defs[j]);
+    }
+    free(defs);
+
+    // a broken file is not cached around, it is reported again next time
+    if (files && ok) {
+        syntaxWriteCache(cache, image, size);
+    }
+    syntaxListFree(files);
+    syntaxUseImage(image, size, 0);
+    return ok ? 0 : -1;
+}
+
+// the syntax an extension (with its dot) or a whole file name selects, NULL for none
+struct editorSyntax *editorSyntaxFind(const char *key) {
+    struct syntaxTable *t = &E.syntax;
+    struct syntaxImageHeader *h = (struct syntaxImageHeader *) t->image;
+    struct syntaxImageSlot *slots = (struct syntaxImageSlot *) &t->image[h->slotsOff];
+    unsigned int hash = syntaxHash(key, strlen(key), 2166136261u);
+    for (int i = hash & (h->slots - 1); slots[i].key; i = (i + 1) & (h->slots - 1)) {
+        if (slots[i].hash == hash && !strcmp(&t->image[slots[i].key], key)) {
+            return &t->syntaxes[slots[i].syntax];
+        }
+    }
+    return NULL;
+}
+
+// pick the syntax for B->filename: by its whole name (Makefile) first, then by its extension
+void editorSelectSyntaxHighlight() {
+    struct editorSyntax *was = B->syntax;
+    B->syntax = NULL;
+    if (B->filename == NULL) return;
+    if (E.syntax.image == NULL) {
+        char msg[1];
+        editorSyntaxLoad(NULL, msg, sizeof(msg));
+    }
+
+    const char *name = strrchr(B->filename, '/');
+    name = name ? name + 1 : B->filename;
+    B->syntax = editorSyntaxFind(name);
+    // strrchr -> returns pointer to the last occurence of a character in a string
+    const char *ext = strrchr(name, '.');
+    if (B->syntax == NULL && ext) {
+        B->syntax = editorSyntaxFind(ext);
+    }
+
+    if (B->syntax != was) {
+        // rows are restyled lazily as they are drawn
+        editorRenderCacheClear();
+        B->hlFrontier = 0;
+        B->hlScanned = 0;
+    }
+}
+
+// UTF-8
+// rows are bytes and are drawn as UTF-8. a glyph is a character together with the zero-width
+// characters after it (combining marks, joiners, variation selectors, skin tones), and takes
+// one or two screen columns. a byte that is not part of valid UTF-8 is a glyph of its own, one
+// column wide
+
+struct widthRange {
+    unsigned int first, last;
+};
+
+// characters drawn on top of the one before them, sorted
+const struct widthRange UTF8_ZERO_WIDTH[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0670, 0x0670 },
+    { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+    { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x0816, 0x082D }, { 0x0900, 0x0902 }, { 0x093A, 0x093A },
+    { 0x093C, 0x093C }, { 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+    { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF },
+    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0x302A, 0x302D },
+    { 0x3099, 0x309A }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF }, { 0x1F3FB, 0x1F3FF },
+    { 0xE0001, 0xE0001 }, { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF },
+};
+
+// characters two columns wide (East Asian wide and fullwidth, emoji), sorted
+const struct widthRange UTF8_DOUBLE_WIDTH[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 },
+    { 0x23F3, 0x23F3 }, { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 }, { 0x267F, 0x267F },
+    { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 }, { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+    { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA }, { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 },
+    { 0x26FA, 0x26FA }, { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B }, { 0x2728, 0x2728 },
+    { 0x274C, 0x274C }, { 0x274E, 0x274E }, { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+    { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 },
+    { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+    { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F },
+    { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 }, { 0x17000, 0x18CFF }, { 0x1B000, 0x1B2FF },
+    { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 },
+    { 0x1F300, 0x1F64F }, { 0x1F680, 0x1F6FF }, { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F9FF }, { 0x1FA70, 0x1FAFF },
+    { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+};
+
+int utf8InRanges(const struct widthRange *ranges, int n, unsigned int c) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (c > ranges[mid].last) {
+            lo = mid + 1;
+        } else if (c < ranges[mid].first) {
+            hi = mid - 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// screen columns a character takes, 0 for one drawn on top of the character before it
+int utf8CharWidth(unsigned int c) {
+    if (c < 0x300) {
+        return 1;
+    }
+    if (utf8InRanges(UTF8_ZERO_WIDTH, sizeof(UTF8_ZERO_WIDTH) / sizeof(UTF8_ZERO_WIDTH[0]), c)) {
+        return 0;
+    }
+    if (utf8InRanges(UTF8_DOUBLE_WIDTH, sizeof(UTF8_DOUBLE_WIDTH) / sizeof(UTF8_DOUBLE_WIDTH[0]), c)) {
+        return 2;
+    }
+    return 1;
+}
+
+// decode the character at s, len bytes of which are there. returns its length in bytes, or 0
+// when they are not valid UTF-8: a stray continuation byte, a sequence cut short, an overlong
+// form, a surrogate or past U+10FFFF
+int utf8Decode(const char *s, int len, unsigned int *c) {
+    unsigned char b = s[0];
+    unsigned int min;
+    int n;
+    if (b < 0x80) {
+        *c = b;
+        return 1;
+    } else if ((b & 0xe0) == 0xc0) {
+        n = 2, min = 0x80, *c = b & 0x1f;
+    } else if ((b & 0xf0) == 0xe0) {
+        n = 3, min = 0x800, *c = b & 0x0f;
+    } else if ((b & 0xf8) == 0xf0) {
+        n = 4, min = 0x10000, *c = b & 0x07;
+    } else {
+        return 0;
+    }
+    if (n > len) {
+        return 0;
+    }
+    for (int j = 1; j < n; j++) {
+        if ((s[j] & 0xc0) != 0x80) {
+            return 0;
+        }
+        *c = (*c << 6) | (s[j] & 0x3f);
+    }
+    if (*c < min || *c > 0x10ffff || (*c >= 0xd800 && *c <= 0xdfff)) {
+        return 0;
+    }
+    return n;
+}
+
+// the end of the glyph starting at s[at], len bytes in all, with the columns it takes in
+// *width. a zero-width character with nothing before it still takes a column
+int utf8GlyphEnd(const char *s, int len, int at, int *width) {
+    unsigned int c;
+    int n = utf8Decode(&s[at], len - at, &c);
+    if (n == 0) {
+        *width = 1;
+        return at + 1;
+    }
+    *width = utf8CharWidth(c);
+    if (*width == 0) {
+        *width = 1;
+    }
+    int end = at + n;
+    while (end < len && (unsigned char) s[end] >= 0x80 && (n = utf8Decode(&s[end], len - end, &c)) && utf8CharWidth(c) == 0) {
+        end += n;
+    }
+    return end;
+}
+
+// ROWS
+
+// move m past the glyph or tab it is at. returns 0 at the end of the row
+int editorRowStep(erow *row, struct columnMark *m) {
+    if (m->chars >= row->size) {
+        return 0;
+    }
+    unsigned char c = row->chars[m->chars];
+    if (c == '\t') {
+        int width = TAB_LENGTH_STOP - m->column % TAB_LENGTH_STOP;
+        m->chars++;
+        m->render += width;
+        m->column += width;
+    } else if (c < 0x80 && (m->chars + 1 == row->size || (unsigned char) row->chars[m->chars + 1] < 0x80)) {
+        m->chars++;
+        m->render++;
+        m->column++;
+    } else {
+        int width;
+        int end = utf8GlyphEnd(row->chars, row->size, m->chars, &width);
+        m->render += end - m->chars;
+        m->column += width;
+        m->chars = end;
+    }
+    return 1;
+}
+
+// room for n chunks in a long row's map, the first keep of them kept
+void editorLongChunksReserve(struct rowRender *rr, int n, int keep) {
+    int need = sizeof(struct longChunk) * n;
+    if (rr->chunks == NULL) {
+        rr->chunks = (struct longChunk *) slabAlloc(need, &rr->chunksCap);
+    } else if (need > rr->chunksCap) {
+        rr->chunks = (struct longChunk *) slabGrow((char *) rr->chunks, &rr->chunksCap, need, sizeof(struct longChunk) * keep);
+    }
+}
+
+// a long row is mapped in chunks instead of marks. only the first one is known, the others
+// start at nominal offsets and are worked out in order as far as they are asked for
+struct rowRender *editorLongRowInit(int filerow, struct rowRender *rr) {
+    erow *row = editorRowAt(filerow);
+    int n = (row->size + LONG_ROW_CHUNK - 1) / LONG_ROW_CHUNK + 1;
+    editorLongChunksReserve(rr, n, 0);
+    rr->longRow = 1;
+    rr->nchunks = n;
+    for (int k = 1; k < n; k++) {
+        rr->chunks[k].at.chars = (k < n - 1) ? k * LONG_ROW_CHUNK : row->size;
+        rr->chunks[k].tabs = 0;
+        rr->chunks[k].known = 0;
+    }
+    rr->chunks[0].at = (struct columnMark) { 0, 0, 0 };
+    rr->chunks[0].hl = editorSyntaxStart(editorRowInState(filerow));
+    rr->chunks[0].known = 1;
+    rr->chunksValid = 1;
+    rr->chunksDone = 1;
+    rr->chunksDirty = 0;
+    rr->marksChunk = -1;
+    rr->winTo = -1;
+    rr->renderSize = 0;
+    return rr;
+}
+
+// make chars a chunk of its own, as chunk at. it is worked out next
+void editorLongChunkSplit(struct rowRender *rr, int at, int chars) {
+    editorLongChunksReserve(rr, rr->nchunks + 1, rr->nchunks);
+    memmove(&rr->chunks[at + 1], &rr->chunks[at], sizeof(struct longChunk) * (rr->nchunks - at));
+    rr->nchunks++;
+    rr->chunks[at].at.chars = chars;
+    rr->chunks[at].tabs = 0;
+    rr->chunks[at].known = 0;
+    if (rr->chunksDone > at) {
+        rr->chunksDone++;
+    }
+}
+
+// work out chunk chunksValid from the one before it: where it really starts, on the first
+// glyph boundary from its nominal offset, its column and the styling state there. a chunk
+// grown past twice LONG_ROW_CHUNK is split first. when the chunk comes out as it was before
+// the last edits, only shifted, the text after it is as it was too: the chunks up to
+// chunksDone are shifted the same way and known right at once. a shift that is not a whole
+// number of tab stops only carries as far as the next tab, which lines the columns up again
+void editorLongChunkNext(erow *row, struct rowRender *rr) {
+    int j = rr->chunksValid;
+    if (rr->chunks[j].at.chars - rr->chunks[j - 1].at.chars > 2 * LONG_ROW_CHUNK) {
+        editorLongChunkSplit(rr, j, rr->chunks[j - 1].at.chars + LONG_ROW_CHUNK);
+    }
+    struct longChunk *prev = &rr->chunks[j - 1], *c = &rr->chunks[j];
+
+    struct columnMark m = prev->at;
+    while (m.chars < c->at.chars && editorRowStep(row, &m)) {
+    }
+    prev->tabs = memchr(&row->chars[prev->at.chars], '\t', m.chars - prev->at.chars) != NULL;
+    struct hlState st = prev->hl;
+    if (B->syntax) {
+        editorSyntaxRun(B->syntax, row->chars, row->size, prev->at.chars, m.chars, NULL, &st);
+    }
+
+    if (c->known && m.chars == c->at.chars && !memcmp(&st, &c->hl, sizeof(st))) {
+        int columns = m.column - c->at.column, render = m.render - c->at.render;
+        int end = rr->chunksDone;
+        for (int k = j; k < end; k++) {
+            rr->chunks[k].at.column += columns;
+            rr->chunks[k].at.render += render;
+            if (columns % TAB_LENGTH_STOP && rr->chunks[k].tabs) {
+                end = k + 1;
+            }
+        }
+        rr->chunksValid = end;
+        rr->chunksDirty = 0;
+        if (end < rr->chunksDone) {
+            editorLongChunkNext(row, rr); // past the tab the rest fall in step by whole tab stops
+        }
+        return;
+    }
+    c->at = m;
+    c->hl = st;
+    c->known = 1;
+    rr->chunksValid++;
+    if (rr->chunksDone < rr->chunksValid) {
+        rr->chunksDone = rr->chunksValid;
+    }
+    if (rr->chunksValid == rr->nchunks) {
+        rr->chunksDirty = 0;
+    }
+}
+
+// the last chunk starting at or before chars offset
+int editorLongChunkFind(struct rowRender *rr, int chars) {
+    int lo = 0, hi = rr->nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (rr->chunks[mid].at.chars <= chars) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// the last chunk starting at or before screen column, worked out as far as the one after it
+int editorLongChunkAtColumn(erow *row, struct rowRender *rr, int column) {
+    while (rr->chunksValid < rr->nchunks && rr->chunks[rr->chunksValid - 1].at.column <= column) {
+        editorLongChunkNext(row, rr);
+    }
+    int lo = 0, hi = rr->chunksValid - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (rr->chunks[mid].at.column <= column) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// the chars [at, at + removed) of a long row were replaced by inserted bytes. chunks past
+// them shift, chunks inside them go, and the chunk holding at is worked out again from the one
+// before it: a glyph may have grown back across its start
+void editorLongRowEdit(struct rowRender *rr, int at, int removed, int inserted) {
+    int k = editorLongChunkFind(rr, at);
+    if (k == rr->nchunks - 1) {
+        k--; // appended: the end of the row moves with it
+    }
+    int first = k + 1, last = first;
+    while (last < rr->nchunks - 1 && rr->chunks[last].at.chars < at + removed) {
+        last++;
+    }
+    if (last > first) {
+        memmove(&rr->chunks[first], &rr->chunks[last], sizeof(struct longChunk) * (rr->nchunks - last));
+        rr->nchunks -= last - first;
+        if (rr->chunksDone > first) {
+            rr->chunksDone = rr->chunksDone > last ? rr->chunksDone - (last - first) : first;
+        }
+    }
+    for (int j = first; j < rr->nchunks; j++) {
+        rr->chunks[j].at.chars += inserted - removed;
+    }
+
+    int redo = k > 1 ? k : 1;
+    if (rr->chunksValid > redo) {
+        rr->chunksValid = redo;
+    }
+    for (int j = rr->chunksValid; j <= k && j < rr->nchunks; j++) {
+        rr->chunks[j].known = 0;
+    }
+    rr->chunksDirty = 1;
+    rr->marksChunk = -1;
+    rr->winTo = -1;
+}
+
+// column marks through chunk k of a long row, as a short row has them through all of it.
+// they are kept for the last chunk asked for, lookups tend to stay in one place
+void editorLongChunkMarks(erow *row, struct rowRender *rr, int k) {
+    if (rr->marksChunk == k) {
+        return;
+    }
+    int from = rr->chunks[k].at.chars;
+    rr->nmarks = (rr->chunks[k + 1].at.chars - from) / COLUMN_MARK_STRIDE + 1;
+    int marksNeed = sizeof(struct columnMark) * rr->nmarks;
+    if (marksNeed > rr->marksCap || rr->marksCap > 4 * marksNeed + 4096) {
+        slabFree((char *) rr->marks, rr->marksCap);
+        rr->marks = (struct columnMark *) slabAlloc(marksNeed, &rr->marksCap);
+    }
+    struct columnMark m = rr->chunks[k].at;
+    for (int j = 0; j < rr->nmarks; j++) {
+        while (m.chars < from + j * COLUMN_MARK_STRIDE && editorRowStep(row, &m)) {
+        }
+        rr->marks[j] = m;
+    }
+    rr->marksChunk = k;
+}
+
+// the mark at the start of the glyph holding chars offset coordX in a long row, its render
+// offset taken within the window
+struct columnMark editorLongMarkAt(erow *row, struct rowRender *rr, int coordX) {
+    int k;
+    while ((k = editorLongChunkFind(rr, coordX)) + 1 >= rr->chunksValid && rr->chunksValid < rr->nchunks) {
+        editorLongChunkNext(row, rr);
+    }
+    if (k == rr->nchunks - 1) {
+        k--; // the end of the row is the end of its last chunk
+    }
+    editorLongChunkMarks(row, rr, k);
+    int j = (coordX - rr->chunks[k].at.chars) / COLUMN_MARK_STRIDE;
+    if (j >= rr->nmarks) {
+        j = rr->nmarks - 1;
+    }
+    while (j > 0 && rr->marks[j].chars > coordX) {
+        j--;
+    }
+    struct columnMark m = rr->marks[j], next = m;
+    while (editorRowStep(row, &next) && next.chars <= coordX) {
+        m = next;
+    }
+    m.render -= rr->winBase;
+    return m;
+}
+
+// the same for the glyph covering screen column
+struct columnMark editorLongMarkAtColumn(erow *row, struct rowRender *rr, int column) {
+    int k = editorLongChunkAtColumn(row, rr, column);
+    if (k == rr->nchunks - 1) {
+        k--;
+    }
+    editorLongChunkMarks(row, rr, k);
+    int lo = 0, hi = rr->nmarks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (rr->marks[mid].column <= column) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    struct columnMark m = rr->marks[lo], next = m;
+    while (editorRowStep(row, &next) && next.column <= column) {
+        m = next;
+    }
+    m.render -= rr->winBase;
+    return m;
+}
+
+// copy chars from m up to the first glyph boundary at or past end into render, indexed from
+// base, with tabs expanded. m is moved along
+void editorRowExpand(erow *row, struct columnMark *m, int end, char *render, int base) {
+    while (m->chars < end) {
+        int run = m->chars;
+        while (run < end && row->chars[run] != '\t' && (unsigned char) row->chars[run] < 0x80) {
+            run++;
+        }
+        if (run > m->chars && run < row->size && (unsigned char) row->chars[run] >= 0x80) {
+            run--; // the last one may carry marks, it is stepped as a glyph
+        }
+        memcpy(&render[m->render - base], &row->chars[m->chars], run - m->chars);
+        m->render += run - m->chars;
+        m->column += run - m->chars;
+        m->chars = run;
+        if (m->chars == end) {
+            break;
+        }
+        struct columnMark from = *m;
+        editorRowStep(row, m);
+        if (row->chars[from.chars] == '\t') {
+            memset(&render[from.render - base], ' ', m->render - from.render);
+        } else {
+            memcpy(&render[from.render - base], &row->chars[from.chars], m->chars - from.chars);
+        }
+    }
+}
+
+// render and style the window of a long row: from the chunk under the left edge of the screen
+// to one chunk past the one beyond its right edge, so tokens running off screen are styled
+// whole. kept while the screen stays within the columns it was built for
+void editorLongRowWindow(int filerow, struct rowRender *rr) {
+    int left = B->colOffset, right = B->colOffset + E.screencols;
+    if (rr->winTo >= 0 && left >= rr->winColumnFrom && (right < rr->winColumnTo || rr->winTo == rr->nchunks - 1)) {
+        return;
+    }
+    erow *row = editorRowAt(filerow);
+    int a = editorLongChunkAtColumn(row, rr, left);
+    int b = editorLongChunkAtColumn(row, rr, right) + 1;
+    if (b > rr->nchunks - 1) {
+        b = rr->nchunks - 1;
+    }
+    int e = b + 1 < rr->nchunks ? b + 1 : b;
+    while (rr->chunksValid <= e) {
+        editorLongChunkNext(row, rr);
+    }
+
+    struct columnMark m = rr->chunks[a].at;
+    int need = rr->chunks[e].at.render - m.render + 1;
+    if (need > rr->cap || rr->cap > 4 * need + 4096) {
+        int cap;
+        slabFree(rr->render, 2 * rr->cap);
+        rr->render = slabAlloc(2 * need, &cap);
+        rr->cap = cap / 2;
+        rr->highlight = (unsigned char *) rr->render + rr->cap;
+    }
+    rr->winBase = m.render;
+    editorRowExpand(row, &m, rr->chunks[e].at.chars, rr->render, rr->winBase);
+    rr->renderSize = m.render - rr->winBase;
+    rr->render[rr->renderSize] = '\0';
+
+    memset(rr->highlight, HL_NORMAL, rr->renderSize);
+    if (B->syntax) {
+        long long start = E.perf.timing ? editorNowNs() : 0;
+        struct hlState st = rr->chunks[a].hl;
+        editorSyntaxRun(B->syntax, rr->render, rr->renderSize, 0, rr->renderSize, rr->highlight, &st);
+        perfStyled(1, start);
+    }
+    rr->winFrom = a;
+    rr->winTo = e;
+    rr->winColumnFrom = rr->chunks[a].at.column;
+    rr->winColumnTo = rr->chunks[b].at.column;
+}
+
+// the comment state a row ends in. a long row just edited settles its chunk map rather than
+// scanning all of it: once a chunk past the edit is back in step, the end is as it was
+int editorRowOutState(int filerow) {
+    erow *row = editorRowAt(filerow);
+    struct rowRender *rr = editorRowCached(row);
+    if (rr && rr->longRow) {
+        while (rr->chunksDirty) {
+            editorLongChunkNext(row, rr);
+        }
+        if (rr->chunksValid < rr->nchunks) {
+            return row->hl_open_comment;
+        }
+        return rr->chunks[rr->nchunks - 1].hl.in_comment;
+    }
+    return editorRowScanState(filerow);
+}
+
+// expand tabs into a render cache slot, map its columns and style it. a long row is only
+// given its chunk map, its window is rendered when it is drawn
+struct rowRender *editorRowBuild(int filerow) {
+    erow *row = editorRowAt(filerow);
+    struct rowRender *rr = editorRenderAcquire(row);
+    if (row->size >= LONG_ROW_BYTES) {
+        return editorLongRowInit(filerow, rr);
+    }
+    if (rr->chunks) {
+        slabFree((char *) rr->chunks, rr->chunksCap);
+        rr->chunks = NULL;
+        rr->chunksCap = 0;
+    }
+    rr->longRow = 0;
+
+    int tabs = 0;
+    int j;
+    for (j = 0; j < row->size; j++) {
+        if (row->chars[j] == '\t') {
+            tabs++;
+        }
+    }
+
+    int need = row->size + tabs*(TAB_LENGTH_STOP - 1) + 1; // max num of characters needed for tab (8)
+    if (need > rr->cap || rr->cap > 4 * need + 4096) {
+        // render and highlight share one block
+        int cap;
+        slabFree(rr->render, 2 * rr->cap);
+        rr->render = slabAlloc(2 * need, &cap);
+        rr->cap = cap / 2;
+        rr->highlight = (unsigned char *) rr->render + rr->cap;
+    }
+    rr->nmarks = row->size / COLUMN_MARK_STRIDE + 1;
+    int marksNeed = sizeof(struct columnMark) * rr->nmarks;
+    if (marksNeed > rr->marksCap || rr->marksCap > 4 * marksNeed + 4096) {
+        slabFree((char *) rr->marks, rr->marksCap);
+        rr->marks = (struct columnMark *) slabAlloc(marksNeed, &rr->marksCap);
+    }
+
+    // render is chars with tabs expanded. glyphs stay as they are, only their columns are counted
+    struct columnMark m = { 0, 0, 0 };
+    int k = 0;
+    while (1) {
+        while (k < rr->nmarks && m.chars >= k * COLUMN_MARK_STRIDE) {
+            rr->marks[k++] = m;
+        }
+        // plain ASCII up to the next mark is copied straight through
+        int stop = k < rr->nmarks ? k * COLUMN_MARK_STRIDE : row->size;
+        int run = m.chars;
+        while (run < stop && row->chars[run] != '\t' && (unsigned char) row->chars[run] < 0x80) {
+            run++;
+        }
+        if (run > m.chars && run < row->size && (unsigned char) row->chars[run] >= 0x80) {
+            run--; // the last one may carry marks, it is stepped as a glyph
+        }
+        memcpy(&rr->render[m.render], &row->chars[m.chars], run - m.chars);
+        m.render += run - m.chars;
+        m.column += run - m.chars;
+        m.chars = run;
+        if (m.chars == stop && stop < row->size) {
+            continue; // the next mark is due
+        }
+        struct columnMark from = m;
+        if (!editorRowStep(row, &m)) {
+            break;
+        }
+        if (row->chars[from.chars] == '\t') {
+            memset(&rr->render[from.render], ' ', m.render - from.render);
+        } else {
+            memcpy(&rr->render[from.render], &row->chars[from.chars], m.chars - from.chars);
+        }
+    }
+    // a row a whole number of strides long ends on its last mark
+    while (k < rr->nmarks) {
+        rr->marks[k++] = m;
+    }
+    rr->render[m.render] = '\0';
+    rr->renderSize = m.render;
+
+    editorSyntaxStyle(rr, editorRowInState(filerow));
+    return rr;
+}
+
+// the mark at the start of the glyph holding chars offset coordX. the walk from the mark
+// before it is at most COLUMN_MARK_STRIDE chars
+struct columnMark editorRowMarkAt(erow *row, struct rowRender *rr, int coordX) {
+    if (rr->longRow) {
+        return editorLongMarkAt(row, rr, coordX);
+    }
+    int k = coordX / COLUMN_MARK_STRIDE;
+    if (k >= rr->nmarks) {
+        k = rr->nmarks - 1;
+    }
+    while (k > 0 && rr->marks[k].chars > coordX) {
+        k--;
+    }
+    struct columnMark m = rr->marks[k], next = m;
+    while (editorRowStep(row, &next) && next.chars <= coordX) {
+        m = next;
+    }
+    return m;
+}
+
+// the mark at the start of the glyph covering screen column, or at the end of the row when
+// it is past it. the marks are searched by column, then walked from
+struct columnMark editorRowMarkAtColumn(erow *row, struct rowRender *rr, int column) {
+    if (rr->longRow) {
+        return editorLongMarkAtColumn(row, rr, column);
+    }
+    int lo = 0, hi = rr->nmarks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (rr->marks[mid].column <= column) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    struct columnMark m = rr->marks[lo], next = m;
+    while (editorRowStep(row, &next) && next.column <= column) {
+        m = next;
+    }
+    return m;
+}
+
+// the row's column map, built if it is not cached. the comment state is caught up through
+// this row first, so the row is styled from the right starting state
+struct rowRender *editorRowMapped(int filerow) {
+    if (B->syntax) {
+        editorSyntaxCatchUp(filerow + 1);
+    }
+
+    erow *row = editorRowAt(filerow);
+    struct rowRender *rr = editorRowCached(row);
+    if (rr == NULL) {
+        rr = editorRowBuild(filerow);
+    }
+    editorRenderAcquire(row);
+    return rr;
+}
+
+// render/highlight for a row about to be drawn or searched. a long row has them for the
+// columns on screen only
+struct rowRender *editorRowRender(int filerow) {
+    struct rowRender *rr = editorRowMapped(filerow);
+    if (rr->longRow) {
+        editorLongRowWindow(filerow, rr);
+    }
+    return rr;
+}
+
+// chars offset of the start of the glyph before coordX in the row
+int editorRowPrevGlyph(int filerow, int coordX) {
+    return coordX > 0 ? editorRowMarkAt(editorRowAt(filerow), editorRowMapped(filerow), coordX - 1).chars : 0;
+}
+
+// chars offset just past the glyph at coordX in the row
+int editorRowNextGlyph(int filerow, int coordX) {
+    erow *row = editorRowAt(filerow);
+    struct columnMark m = editorRowMarkAt(row, editorRowMapped(filerow), coordX);
+    editorRowStep(row, &m);
+    return m.chars;
+}
+
+// carry a row's new comment state down the file
+void editorSyntaxRowChanged(int filerow) {
+    if (B->syntax == NULL) {
+        return;
+    }
+    if (filerow < B->hlFrontier) {
+        editorSyntaxPropagate(filerow);
+    } else if (filerow < B->hlScanned) {
+        B->hlScanned = filerow;
+    }
+}
+
+// the row's chars changed: drop its render and carry its new comment state down the file
+void editorUpdateRow(int filerow) {
+    editorRowInvalidate(editorRowAt(filerow));
+    editorSyntaxRowChanged(filerow);
+}
+
+// chars [at, at + removed) of the row were replaced by inserted bytes. a long row keeps its
+// chunk map, redone only from the chunk the edit touched, any other row is rendered again.
+// only rendering and styling stay local: the chars are one buffer, and the edit has already
+// moved everything after at
+void editorRowEdited(int filerow, int at, int removed, int inserted) {
+    erow *row = editorRowAt(filerow);
+    struct rowRender *rr = editorRowCached(row);
+    if (rr == NULL || !rr->longRow || row->size < LONG_ROW_BYTES) {
+        editorUpdateRow(filerow);
+        return;
+    }
+    editorLongRowEdit(rr, at, removed, inserted);
+    editorSyntaxRowChanged(filerow);
+}
+
+void editorAppendRow(int at, char *s, size_t len) {
+    if (at < 0 || at > B->numrows) {
+        return;
+    }
+
+    erow row;
+    row.size = len;
+    row.chars = slabAlloc(len + 1, &row.cap);
+    memcpy(row.chars, s, len);
+    row.chars[len] = '\0';
+
+    row.renderSlot = -1;
+    row.renderGen = 0;
+    // start from the state the row below used to see, so a change is noticed and propagated
+    row.hl_open_comment = (at > 0 && at - 1 < B->hlFrontier) ? editorRowAt(at - 1)->hl_open_comment : 0;
+
+    rowTreeInsert(at, &row);
+    B->numrows++;
+    if (at < B->hlFrontier) {
+        B->hlFrontier++;
+        B->hlScanned++;
+    }
+    editorUpdateRow(at);
+
+    B->isDirty = 1;
+}
+
+int editorRowIsMapped(erow *row) {
+    return B->map && row->chars >= B->map && row->chars < B->map + B->mapSize;
+}
+
+// copy a row out of the file mapping before it is modified
+void editorRowDetach(erow *row) {
+    if (!editorRowIsMapped(row)) {
+        return;
+    }
+    char *chars = slabAlloc(row->size + 1, &row->cap);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    row->chars = chars;
+}
+
+// make the row's chars its own and big enough for need bytes, terminator included
+void editorRowReserve(erow *row, int need) {
+    editorRowDetach(row);
+    row->chars = slabGrow(row->chars, &row->cap, need, row->size + 1);
+}
+
+void editorFreeRow(erow *row) {
+    editorRowInvalidate(row);
+    if (!editorRowIsMapped(row)) {
+        slabFree(row->chars, row->cap);
+    }
+}
+
+void rowTreeFree(rowNode *node) {
+    if (node->left) {
+        rowTreeFree(node->left);
+        rowTreeFree(node->right);
+    } else {
+        for (int j = 0; j < node->count; j++) {
+            editorFreeRow(&node->rows[j]);
+        }
+        free(node->rows);
+    }
+    free(node);
+}
+
+void editorFreeRows() {
+    if (B->rows) {
+        rowTreeFree(B->rows);
+    }
+    B->rows = NULL;
+    B->rowMaxLeaves = 0;
+    B->rowCacheLeaf = NULL;
+    B->numrows = 0;
+    B->hlFrontier = 0;
+    B->hlScanned = 0;
+}
+
+void editorDelRow(int at) {
+    if (at < 0 || at >= B->numrows) {
+        return;
+    }
+
+    erow *row = editorRowAt(at);
+    int open_comment = row->hl_open_comment;
+    editorFreeRow(row);
+    rowTreeDelete(at);
+
+    if (at < B->hlFrontier) {
+        B->hlFrontier--;
+        B->hlScanned--;
+    } else if (at < B->hlScanned) {
+        B->hlScanned = at;
+    }
+    B->numrows--;
+    B->isDirty = 1;
+
+    // the row sliding up now follows a different row, restyle it if that changes what it sees
+    int prev_comment = (at > 0) ? editorRowAt(at - 1)->hl_open_comment : 0;
+    if (at < B->numrows && prev_comment != open_comment) {
+        editorUpdateRow(at);
+    }
+}
+
+// forget the first count rows at once
+void editorDropRows(int count) {
+    if (count > B->numrows) {
+        count = B->numrows;
+    }
+    if (count <= 0) {
+        return;
+    }
+    int open_comment = editorRowAt(count - 1)->hl_open_comment;
+    for (int j = 0; j < count; j++) {
+        editorFreeRow(editorRowAt(j));
+    }
+    rowTreeDropFront(count);
+    B->numrows -= count;
+    B->hlFrontier = B->hlFrontier > count ? B->hlFrontier - count : 0;
+    B->hlScanned = B->hlScanned > count ? B->hlScanned - count : 0;
+    B->isDirty = 1;
+
+    // the new first row no longer follows an open comment
+    if (B->numrows > 0 && open_comment) {
+        editorUpdateRow(0);
+    }
+}
+
+void editorRowInsertChar(int filerow, int at, int c) {
+    erow *row = editorRowAt(filerow);
+    if (at < 0 || at > row->size) {
+        at = row->size;
+    }
+
+    editorRowReserve(row, row->size + 2);
+
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    editorRowEdited(filerow, at, 0, 1);
+    B->isDirty = 1;
+}
+
+void editorRowAppendString(int filerow, char *s, size_t len) {
+    erow *row = editorRowAt(filerow);
+    editorRowReserve(row, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorRowEdited(filerow, row->size - len, 0, len);
+    B->isDirty = 1;
+}
+
+// insert len bytes at (filerow, at), within the row
+void editorRowInsertString(int filerow, int at, const char *s, size_t len) {
+    erow *row = editorRowAt(filerow);
+    editorRowReserve(row, row->size + len + 1);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    editorRowEdited(filerow, at, 0, len);
+    B->isDirty = 1;
+}
+
+void editorRowDelChars(int filerow, int at, int len) {
+    erow *row = editorRowAt(filerow);
+    editorRowDetach(row);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    editorRowEdited(filerow, at, len, 0);
+    B->isDirty = 1;
+}
+
+// replace len bytes at (filerow, at) with slen bytes of s, the row restyled once
+void editorRowReplace(int filerow, int at, int len, const char *s, int slen) {
+    erow *row = editorRowAt(filerow);
+    int size = row->size - len + slen;
+    editorRowReserve(row, (size > row->size ? size : row->size) + 1);
+    memmove(&row->chars[at + slen], &row->chars[at + len], row->size - at - len + 1);
+    memcpy(&row->chars[at], s, slen);
+    row->size = size;
+    editorRowEdited(filerow, at, len, slen);
+    B->isDirty = 1;
+}
+
+// cut the row off at column at
+void editorRowTruncate(int filerow, int at) {
+    erow *row = editorRowAt(filerow);
+    editorRowDetach(row);
+    int removed = row->size - at;
+    row->size = at;
+    row->chars[row->size] = '\0';
+    editorRowEdited(filerow, at, removed, 0);
+    B->isDirty = 1;
+}
+
+// insert text that may span rows at (filerow, at), reporting where it ends. the rest of the
+// row moves to the end of the last inserted row. an empty buffer gets its first row made
+void editorInsertText(int filerow, int at, const char *s, int len, int *endRow, int *endCol) {
+    if (filerow == 0 && B->numrows == 0) {
+        editorAppendRow(0, "", 0);
+    }
+    const char *nl = memchr(s, '\n', len);
+    if (nl == NULL) {
+        editorRowInsertString(filerow, at, s, len);
+        *endRow = filerow;
+        *endCol = at + len;
+        return;
+    }
+
+    erow *row = editorRowAt(filerow);
+    int tailLen = row->size - at;
+    char *tail = malloc(tailLen + 1);
+    memcpy(tail, &row->chars[at], tailLen);
+    editorRowTruncate(filerow, at);
+    editorRowAppendString(filerow, (char *) s, nl - s);
+
+    const char *p = nl + 1;
+    const char *end = s + len;
+    int r = filerow + 1;
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        editorAppendRow(r++, (char *) p, nl - p);
+        p = nl + 1;
+    }
+    editorAppendRow(r, (char *) p, end - p);
+    editorRowAppendString(r, tail, tailLen);
+    free(tail);
+    *endRow = r;
+    *endCol = end - p;
+}
+
+// delete len bytes starting at (filerow, at), counting a row break as one. deleting nothing
+// from a buffer of one empty row undoes the row a newline made in an empty buffer
+void editorDeleteText(int filerow, int at, int len) {
+    if (len == 0 && filerow == 0 && B->numrows == 1 && editorRowAt(0)->size == 0) {
+        editorDelRow(0);
+        return;
+    }
+    int r = filerow, c = at;
+    while (len > editorRowAt(r)->size - c && r + 1 < B->numrows) {
+        len -= editorRowAt(r)->size - c + 1;
+        r++;
+        c = 0;
+    }
+    c += len;
+    if (r == filerow) {
+        editorRowDelChars(filerow, at, c - at);
+        return;
+    }
+
+    erow *last = editorRowAt(r);
+    editorRowTruncate(filerow, at);
+    editorRowAppendString(filerow, &last->chars[c], last->size - c);
+    for (int k = filerow; k < r; k++) {
+        editorDelRow(filerow + 1);
+    }
+}
+
+// SWAP JOURNAL
+// every edit applied to the buffer is appended to .name.swp beside the file, against the file
+// as it was on disk when journalling started. a save or a clean quit removes it. after a crash
+// the next open replays the records over the unchanged file, which only costs as much as the
+// journal is long
+
+void *journalWriter(void *arg) {
+    struct editorJournal *j = arg;
+    char *buf = NULL;
+    size_t cap = 0;
+
+    pthread_mutex_lock(&j->lock);
+    while (1) {
+        while (!j->stop && !j->restart && j->pendingLen == 0) {
+            pthread_cond_wait(&j->wake, &j->lock);
+        }
+        int restart = j->restart;
+        struct journalHeader header = j->header;
+        char *path = j->path ? strdup(j->path) : NULL;
+        // take the pending records, leaving our emptied buffer to fill
+        char *records = j->pending;
+        size_t recordsCap = j->pendingCap;
+        size_t len = j->pendingLen;
+        j->pending = buf;
+        j->pendingCap = cap;
+        j->pendingLen = 0;
+        j->restart = 0;
+        int stop = j->stop;
+        buf = records;
+        cap = recordsCap;
+        pthread_mutex_unlock(&j->lock);
+
+        int err = 0;
+        if (restart) {
+            if (j->fd != -1) {
+                close(j->fd);
+                j->fd = -1;
+            }
+            if (path && unlink(path) == -1 && errno != ENOENT) {
+                err = errno;
+            }
+        }
+        if (len > 0 && path) {
+            if (j->fd == -1) {
+                // a recovered journal is carried on, a new one starts with the header
+                struct stat st;
+                j->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+                if (j->fd != -1 && fstat(j->fd, &st) == 0 && st.st_size == 0 &&
+                        write(j->fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+                    err = errno;
+                }
+            }
+            struct iovec iov = { buf, len };
+            if (j->fd == -1 || writevAll(j->fd, &iov, 1) == -1 || fdatasync(j->fd) == -1) {
+                err = errno;
+            }
+        }
+        free(path);
+
+        if (err) {
+            editorWake(WAKE_TASK);
+        }
+        pthread_mutex_lock(&j->lock);
+        if (err) {
+            j->failed = err;
+        }
+        if (stop && j->pendingLen == 0 && !j->restart) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+    if (j->fd != -1) {
+        close(j->fd);
+        j->fd = -1;
+    }
+    free(buf);
+    return NULL;
+}
+
+void journalInit() {
+    pthread_mutex_init(&B->journal.lock, NULL);
+    pthread_cond_init(&B->journal.wake, NULL);
+    B->journal.ready = 1;
+    B->journal.running = 0;
+    B->journal.path = NULL;
+    B->journal.fd = -1;
+    B->journal.pending = NULL;
+    B->journal.pendingLen = B->journal.pendingCap = 0;
+}
+
+// dir/.name.swp for the file B->filename names, following symlinks like a save does
+char *journalPath() {
+    char *target = realpath(B->filename, NULL);
+    if (target == NULL) {
+        target = strdup(B->filename);
+    }
+    char *slash = strrchr(target, '/');
+    int dirlen = slash ? slash - target + 1 : 0;
+    size_t len = strlen(target) + sizeof("..swp");
+    char *path = malloc(len);
+    snprintf(path, len, "%.*s.%s.swp", dirlen, target, target + dirlen);
+    free(target);
+    return path;
+}
+
+void journalHeaderFor(struct journalHeader *h, struct stat *st) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+    h->size = st->st_size;
+    h->mtimeSec = st->st_mtim.tv_sec;
+    h->mtimeNsec = st->st_mtim.tv_nsec;
+    h->ino = st->st_ino;
+    h->pid = getpid();
+}
+
+// journal edits from here on against the file as it now is on disk. a swap file left at path
+// is removed first, unless keep says to carry on appending to it
+void journalStart(int keep) {
+    struct editorJournal *j = &B->journal;
+    struct stat st;
+    if (!j->ready || B->filename == NULL || stat(B->filename, &st) == -1) {
+        return;
+    }
+    pthread_mutex_lock(&j->lock);
+    free(j->path);
+    j->path = journalPath();
+    journalHeaderFor(&j->header, &st);
+    j->pendingLen = 0;
+    j->restart = !keep;
+    j->stop = 0;
+    if (!j->running) {
+        j->running = pthread_create(&j->writer, NULL, journalWriter, j) == 0;
+    }
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+}
+
+// flush what is queued and stop journalling. discard removes the swap file instead, the edits
+// are not wanted
+void journalStop(int discard) {
+    struct editorJournal *j = &B->journal;
+    if (!j->running) {
+        return;
+    }
+    pthread_mutex_lock(&j->lock);
+    if (discard) {
+        j->pendingLen = 0;
+        j->restart = 1;
+    }
+    j->stop = 1;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->writer, NULL);
+    j->running = 0;
+    free(j->path);
+    j->path = NULL;
+}
+
+// queue an edit for the writer. s is the inserted text, ignored for deletes
+void journalAppend(int kind, int row, int col, const char *s, int len) {
+    struct editorJournal *j = &B->journal;
+    if (j->path == NULL) {
+        return;
+    }
+    size_t textLen = kind == UNDO_INSERT ? len : 0;
+    size_t size = sizeof(struct journalRecord) + textLen;
+
+    pthread_mutex_lock(&j->lock);
+    if (j->pendingLen + size > j->pendingCap) {
+        size_t cap = j->pendingCap ? j->pendingCap : 4096;
+        while (cap < j->pendingLen + size) {
+            cap *= 2;
+        }
+        j->pending = realloc(j->pending, cap);
+        j->pendingCap = cap;
+    }
+    struct journalRecord rec = { kind, row, col, len };
+    memcpy(&j->pending[j->pendingLen], &rec, sizeof(rec));
+    memcpy(&j->pending[j->pendingLen + sizeof(rec)], s, textLen);
+    j->pendingLen += size;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+}
+
+// say so if the writer failed since the last look
+void journalReport() {
+    struct editorJournal *j = &B->journal;
+    if (!j->ready) {
+        return;
+    }
+    pthread_mutex_lock(&j->lock);
+    int failed = j->failed;
+    j->failed = 0;
+    pthread_mutex_unlock(&j->lock);
+    if (failed) {
+        editorSetStatusMessage("Swap file write failed: %s", strerror(failed));
+    }
+}
+
+// apply the journal's records to the freshly opened file. stops at the first record that does
+// not fit the buffer, like a torn one at the end. returns the bytes of journal applied
+size_t journalReplay(const char *data, size_t size) {
+    size_t off = sizeof(struct journalHeader);
+    while (off + sizeof(struct journalRecord) <= size) {
+        struct journalRecord rec;
+        memcpy(&rec, &data[off], sizeof(rec));
+        const char *text = &data[off + sizeof(rec)];
+        size_t textLen = rec.kind == UNDO_INSERT ? (size_t) rec.len : 0;
+        if ((rec.kind != UNDO_INSERT && rec.kind != UNDO_DELETE) || rec.len < 0 ||
+                off + sizeof(rec) + textLen > size || rec.row < 0 || rec.col < 0) {
+            break;
+        }
+        if (rec.row == B->numrows && B->numrows == 0 && rec.kind == UNDO_INSERT) {
+            editorAppendRow(0, "", 0); // the row typing into an empty buffer creates
+        }
+        if (rec.row >= B->numrows || rec.col > editorRowAt(rec.row)->size) {
+            break;
+        }
+        if (rec.kind == UNDO_INSERT) {
+            editorInsertText(rec.row, rec.col, text, rec.len, &B->coordY, &B->coordX);
+        } else {
+            editorDeleteText(rec.row, rec.col, rec.len);
+            B->coordY = rec.row;
+            B->coordX = rec.col;
+        }
+        off += sizeof(rec) + textLen;
+    }
+    return off;
+}
+
+int journalAsk(const char *fmt, const char *path) {
+    E.prompting = 1;
+    while (1) {
+        editorSetStatusMessage(fmt, path);
+        editorRefreshScreen();
+        int c = editorReadKey();
+        if (c == 'y' || c == 'Y' || c == 'n' || c == 'N' || c == '\x1b') {
+            E.prompting = 0;
+            return c == 'y' || c == 'Y';
+        }
+    }
+}
+
+// called once the file named B->filename is loaded, st being what it was opened as. a swap
+// file left by a crash is offered for replay, then journalling starts. followed files are
+// not journalled
+void journalOpen(struct stat *st) {
+    // a followed file keeps growing under the journal, its records would not replay
+    if (!B->journal.ready || B->follow.on) {
+        return;
+    }
+    char *path = journalPath();
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        free(path);
+        journalStart(0);
+        return;
+    }
+
+    struct stat jst;
+    struct journalHeader want, *have = NULL;
+    char *data = MAP_FAILED;
+    journalHeaderFor(&want, st);
+    if (fstat(fd, &jst) == 0 && (size_t) jst.st_size >= sizeof(want)) {
+        data = mmap(NULL, jst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        have = data == MAP_FAILED ? NULL : (struct journalHeader *) data;
+    }
+    close(fd);
+
+    if (have && memcmp(have->magic, want.magic, sizeof(want.magic)) == 0 && have->pid != want.pid &&
+            kill(have->pid, 0) == 0) {
+        editorSetStatusMessage("%s is in use by process %d, edits not journalled", path, have->pid);
+    } else if (have && (memcmp(have->magic, want.magic, sizeof(want.magic)) != 0 ||
+            have->size != want.size || have->mtimeSec != want.mtimeSec ||
+            have->mtimeNsec != want.mtimeNsec || have->ino != want.ino)) {
+        editorSetStatusMessage("%s is for another version of the file, edits not journalled", path);
+    } else if (have && jst.st_size > (off_t) sizeof(want) &&
+            journalAsk("Unsaved edits found in %s. Recover them? (y/n)", path)) {
+        size_t applied = journalReplay(data, jst.st_size);
+        if (applied < (size_t) jst.st_size && truncate(path, applied) == -1) {
+            // the torn tail stays, the next recovery stops at it again
+        }
+        editorSetStatusMessage("Recovered %zu bytes of edits", applied - sizeof(want));
+        journalStart(1);
+    } else {
+        journalStart(0);
+    }
+    if (data != MAP_FAILED) {
+        munmap(data, jst.st_size);
+    }
+    free(path);
+}
+
+// UNDO
+// edits are journalled as the text they inserted or deleted, never as snapshots. ops are laid
+// out back to back in one arena, a header followed by its text, so undo walks back from
+// undoLast and redo forward from undoTop one group at a time. typed characters extend the
+// op they follow instead of adding one, and past UNDO_MAX_BYTES the oldest groups are dropped
+
+struct undoOp *editorUndoOp(size_t offset) {
+    return (struct undoOp *) &B->undoLog[offset];
+}
+
+size_t editorUndoOpSize(int len) {
+    size_t align = sizeof(int);
+    return sizeof(struct undoOp) + (len + align - 1) / align * align;
+}
+
+void editorUndoClear() {
+    free(B->undoLog);
+    B->undoLog = NULL;
+    B->undoLen = B->undoCap = B->undoTop = 0;
+    B->undoLast = -1;
+    B->undoBroken = 1;
+}
+
+// make room for bytes more at the end of the journal, dropping the oldest groups when the cap
+// would be passed. each trim frees a quarter of the cap, so the memmove stays cheap overall.
+// returns 0 when the op alone is over the cap and nothing can be kept
+int editorUndoReserve(size_t bytes) {
+    if (B->undoLen + bytes > UNDO_MAX_BYTES) {
+        if (bytes > UNDO_MAX_BYTES / 2) {
+            editorUndoClear();
+            return 0;
+        }
+        size_t cut = 0;
+        while (cut < B->undoLen && B->undoLen - cut + bytes > UNDO_MAX_BYTES / 4 * 3) {
+            int group = editorUndoOp(cut)->group;
+            while (cut < B->undoLen && editorUndoOp(cut)->group == group) {
+                cut += editorUndoOpSize(editorUndoOp(cut)->len);
+            }
+        }
+        memmove(B->undoLog, &B->undoLog[cut], B->undoLen - cut);
+        B->undoLen -= cut;
+        B->undoTop -= cut;
+        B->undoLast = (B->undoLast >= (long) cut) ? B->undoLast - (long) cut : -1;
+        if (B->undoLen > 0) {
+            editorUndoOp(0)->prevSize = 0;
+        }
+    }
+    if (B->undoLen + bytes > B->undoCap) {
+        size_t cap = B->undoCap ? B->undoCap : 4096;
+        while (cap < B->undoLen + bytes) {
+            cap *= 2;
+        }
+        B->undoLog = realloc(B->undoLog, cap);
+        B->undoCap = cap;
+    }
+    return 1;
+}
+
+// the last op applied when it is also the newest in the journal and the run was not broken,
+// the one a keystroke may extend
+struct undoOp *editorUndoOpen() {
+    if (B->undoBroken || B->undoLast < 0 || B->undoTop != B->undoLen) {
+        return NULL;
+    }
+    return editorUndoOp(B->undoLast);
+}
+
+// add an op with room for len bytes of text after it, which the caller fills in. returns NULL
+// when it is over the cap, the history then being gone
+struct undoOp *editorUndoPush(int kind, int run, int newGroup, int row, int col, int len) {
+    B->undoLen = B->undoTop; // a new edit forgets what was undone
+    size_t size = editorUndoOpSize(len);
+    if (!editorUndoReserve(size)) {
+        return NULL;
+    }
+    if (newGroup) {
+        B->undoGroup++;
+    }
+    struct undoOp *op = editorUndoOp(B->undoLen);
+    op->kind = kind;
+    op->run = run;
+    op->group = B->undoGroup;
+    op->row = row;
+    op->col = col;
+    op->len = len;
+    op->prevSize = B->undoLast >= 0 ? B->undoLen - B->undoLast : 0;
+
+    B->undoLast = B->undoLen;
+    B->undoLen += size;
+    B->undoTop = B->undoLen;
+    B->undoSerial++;
+    B->undoBroken = 0;
+    return op;
+}
+
+void editorUndoRecord(int kind, int run, int newGroup, int row, int col, const char *s, int len) {
+    journalAppend(kind, row, col, s, len);
+    struct undoOp *op = editorUndoPush(kind, run, newGroup, row, col, len);
+    if (op) {
+        memcpy(op + 1, s, len);
+    }
+}
+
+// add typed characters to the end of the open run
+void editorUndoExtend(const char *s, int len) {
+    struct undoOp *op = editorUndoOp(B->undoLast);
+    journalAppend(UNDO_INSERT, op->row, op->col + op->len, s, len);
+    size_t size = editorUndoOpSize(op->len + len);
+    if (B->undoLast + size > B->undoLen) {
+        if (!editorUndoReserve(size - editorUndoOpSize(op->len)) || B->undoLast < 0) {
+            return;
+        }
+        op = editorUndoOp(B->undoLast);
+    }
+    memcpy((char *) (op + 1) + op->len, s, len);
+    op->len += len;
+    B->undoLen = B->undoTop = B->undoLast + size;
+    B->undoSerial++;
+}
+
+// rewrite the rows of an UNDO_REPLACE back to their old text, or when redo is set forward to
+// the new text again
+void editorUndoReplace(struct undoOp *op, int redo) {
+    struct undoReplace *rows = (struct undoReplace *) (op + 1);
+    char *oldText = (char *) &rows[op->row], *newText = oldText;
+    for (int j = 0; j < op->row; j++) {
+        newText += rows[j].oldLen;
+    }
+    for (int j = 0; j < op->row; j++) {
+        struct undoReplace *r = &rows[j];
+        int len = redo ? r->oldLen : r->newLen;
+        const char *s = redo ? newText : oldText;
+        int slen = redo ? r->newLen : r->oldLen;
+        journalAppend(UNDO_DELETE, r->row, r->col, NULL, len);
+        journalAppend(UNDO_INSERT, r->row, r->col, s, slen);
+        editorRowReplace(r->row, r->col, len, s, slen);
+        oldText += r->oldLen;
+        newText += r->newLen;
+    }
+    B->coordY = rows[0].row;
+    B->coordX = rows[0].col;
+}
+
+void editorUndo() {
+    if (B->undoLast < 0) {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    int group = editorUndoOp(B->undoLast)->group;
+    while (B->undoLast >= 0 && editorUndoOp(B->undoLast)->group == group) {
+        struct undoOp *op = editorUndoOp(B->undoLast);
+        if (op->kind == UNDO_REPLACE) {
+            editorUndoReplace(op, 0);
+        } else if (op->kind == UNDO_INSERT) {
+            journalAppend(UNDO_DELETE, op->row, op->col, NULL, op->len);
+            editorDeleteText(op->row, op->col, op->len);
+            B->coordY = op->row;
+            B->coordX = op->col;
+        } else {
+            journalAppend(UNDO_INSERT, op->row, op->col, (char *) (op + 1), op->len);
+            editorInsertText(op->row, op->col, (char *) (op + 1), op->len, &B->coordY, &B->coordX);
+        }
+        B->undoTop = B->undoLast;
+        B->undoLast = op->prevSize ? B->undoLast - op->prevSize : -1;
+    }
+    B->undoBroken = 1;
+}
+
+void editorRedo() {
+    if (B->undoTop >= B->undoLen) {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    int group = editorUndoOp(B->undoTop)->group;
+    while (B->undoTop < B->undoLen && editorUndoOp(B->undoTop)->group == group) {
+        struct undoOp *op = editorUndoOp(B->undoTop);
+        if (op->kind == UNDO_REPLACE) {
+            editorUndoReplace(op, 1);
+        } else if (op->kind == UNDO_INSERT) {
+            journalAppend(op->kind, op->row, op->col, (char *) (op + 1), op->len);
+            editorInsertText(op->row, op->col, (char *) (op + 1), op->len, &B->coordY, &B->coordX);
+        } else {
+            journalAppend(op->kind, op->row, op->col, NULL, op->len);
+            editorDeleteText(op->row, op->col, op->len);
+            B->coordY = op->row;
+            B->coordX = op->col;
+        }
+        B->undoLast = B->undoTop;
+        B->undoTop += editorUndoOpSize(op->len);
+    }
+    B->undoBroken = 1;
+}
+
+void editorDeleteChar() {
+    if (B->coordY == B->numrows) {
+        return;
+    }
+    // do nothing if at start of first line
+    if (B->coordX == 0 && B->coordY == 0) {
+        return;
+    }
+
+    erow *row = editorRowAt(B->coordY);
+
+    if (B->coordX > 0) {
+        // the whole glyph goes, with any marks on it
+        int at = editorRowPrevGlyph(B->coordY, B->coordX);
+        int len = B->coordX - at;
+        // a run of backspaces (or deletes) is undone in one go
+        struct undoOp *open = editorUndoOpen();
+        int joins = open && open->kind == UNDO_DELETE && open->run && open->row == B->coordY &&
+                (open->col == B->coordX || open->col == at);
+        editorUndoRecord(UNDO_DELETE, 1, !joins, B->coordY, at, &row->chars[at], len);
+        editorRowDelChars(B->coordY, at, len);
+        B->coordX = at;
+    } else {
+        B->coordX = editorRowAt(B->coordY - 1)->size;
+        editorUndoRecord(UNDO_DELETE, 0, 1, B->coordY - 1, B->coordX, "\n", 1);
+        editorRowAppendString(B->coordY - 1, row->chars, row->size);
+        editorDelRow(B->coordY);
+        B->coordY--;
+    }
+}
+
+// ops
+
+// insert typed characters at the cursor, all on its row, as part of the run of typing they
+// continue
+void editorInsertChars(const char *s, int len) {
+    struct undoOp *open = editorUndoOpen();
+    if (open && open->kind == UNDO_INSERT && open->run && open->row == B->coordY &&
+            open->col + open->len == B->coordX) {
+        editorUndoExtend(s, len);
+    } else {
+        int newGroup = 1;
+        if (B->coordY == B->numrows && B->numrows > 0) {
+            // typing below the last row first breaks the last row
+            editorUndoRecord(UNDO_INSERT, 0, 1, B->numrows - 1, editorRowAt(B->numrows - 1)->size, "\n", 1);
+            newGroup = 0;
+        }
+        editorUndoRecord(UNDO_INSERT, 1, newGroup, B->coordY, B->coordX, s, len);
+    }
+
+    if (B->coordY == B->numrows) {
+        editorAppendRow(B->numrows, "", 0);
+    }
+    editorRowInsertString(B->coordY, B->coordX, s, len);
+    B->coordX += len;
+}
+
+void editorInsertChar(int c) {
+    char ch = c;
+    editorInsertChars(&ch, 1);
+}
+
+// insert a block of text that may span rows at the cursor, as one edit undone on its own
+void editorInsertBlock(const char *s, int len) {
+    if (len == 0) {
+        return;
+    }
+    int newGroup = 1;
+    if (B->coordY == B->numrows && B->numrows > 0) {
+        editorUndoRecord(UNDO_INSERT, 0, 1, B->numrows - 1, editorRowAt(B->numrows - 1)->size, "\n", 1);
+        newGroup = 0;
+    }
+    editorUndoRecord(UNDO_INSERT, 0, newGroup, B->coordY, B->coordX, s, len);
+
+    if (B->coordY == B->numrows) {
+        editorAppendRow(B->numrows, "", 0);
+    }
+    editorInsertText(B->coordY, B->coordX, s, len, &B->coordY, &B->coordX);
+    B->undoBroken = 1;
+}
+
+// a bracketed paste goes in as one block, rows restyled and the screen drawn once for all of it
+void editorPaste() {
+    struct abuf ab = ABUF_INIT;
+    editorReadPaste(&ab);
+    editorInsertBlock(ab.b, ab.len);
+    abFree(&ab);
+}
+
+void editorInsertNewline() {
+    if (B->coordY < B->numrows) {
+        editorUndoRecord(UNDO_INSERT, 0, 1, B->coordY, B->coordX, "\n", 1);
+    } else if (B->numrows > 0) {
+        editorUndoRecord(UNDO_INSERT, 0, 1, B->numrows - 1, editorRowAt(B->numrows - 1)->size, "\n", 1);
+    } else {
+        // an empty buffer only gains its first row, recorded as inserting nothing into it
+        editorUndoRecord(UNDO_INSERT, 0, 1, 0, 0, "", 0);
+    }
+
+    // if at start of line, just append a blank row
+    if (B->coordX == 0) {
+        editorAppendRow(B->coordY, "", 0);
+    } else {
+        // otherwise, split current line and pass rightward chars to the new row
+        erow *row = editorRowAt(B->coordY); // reassign the pointer to keep it from being invalidated
+        editorAppendRow(B->coordY + 1, &row->chars[B->coordX], row->size - B->coordX);
+        editorRowTruncate(B->coordY, B->coordX);
+    }
+    B->coordY++;
+    B->coordX = 0;
+}
+
+// file handling
+
+// one slice of the mapped file. the scan runs twice: count newlines, then fill rows
+struct lineScan {
+    const char *map;
+    size_t from, to; // byte range of this slice
+    size_t eof; // mapping size, so the last slice knows about a trailing unterminated line
+    rowNode **leaves; // leaf blocks of the whole file (pass 2)
+    size_t first; // index of the first row owned by this slice
+    int count; // rows owned by this slice
+    int crlf, lf; // of its rows, those ended by \r\n and those by \n alone (pass 2)
+};
+
+// a row is owned by the slice holding its terminating newline
+void *editorScanCount(void *arg) {
+    struct lineScan *ls = arg;
+    const char *p = ls->map + ls->from;
+    const char *end = ls->map + ls->to;
+    int count = 0;
+
+    // memchr is vectorized in libc, so this runs at memory bandwidth
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        p++;
+    }
+    if (ls->to == ls->eof && ls->eof > 0 && ls->map[ls->eof - 1] != '\n') {
+        count++;
+    }
+    ls->count = count;
+    return NULL;
+}
+
+void *editorScanFill(void *arg) {
+    struct lineScan *ls = arg;
+    const char *map = ls->map;
+    const char *p = map + ls->from;
+    const char *end = map + ls->to;
+
+    // the first row may start in an earlier slice
+    const char *start = p;
+    if (ls->from > 0) {
+        const char *nl = memrchr(map, '\n', ls->from);
+        start = nl ? nl + 1 : map;
+    }
+
+    int n = 0;
+    ls->crlf = ls->lf = 0;
+    while (n < ls->count) {
+        const char *nl = (p < end) ? memchr(p, '\n', end - p) : NULL;
+        const char *stop = nl ? nl : map + ls->eof;
+        int len = stop - start;
+
+        // only the \r of a \r\n is the line ending's, any other is text and kept
+        if (nl && len > 0 && start[len - 1] == '\r') {
+            len--;
+            ls->crlf++;
+        } else if (nl) {
+            ls->lf++;
+        }
+
+        size_t at = ls->first + n;
+        erow *row = &ls->leaves[at / ROW_LEAF_SIZE]->rows[at % ROW_LEAF_SIZE];
+        row->size = len;
+        row->cap = 0;
+        row->chars = (char *) start;
+        row->hl_open_comment = 0;
+        row->renderSlot = -1;
+        row->renderGen = 0;
+        n++;
+
+        if (!nl) {
+            break;
+        }
+        p = start = nl + 1;
+    }
+    return NULL;
+}
+
+// run pass over each of ntasks tasks of size bytes, the first on this thread and the rest on
+// threads of their own
+void editorRunParallel(void *(*pass)(void *), void *tasks, size_t size, int ntasks) {
+    pthread_t threads[LOAD_MAX_THREADS];
+    int started[LOAD_MAX_THREADS];
+    char *task = tasks;
+
+    for (int t = 1; t < ntasks; t++) {
+        started[t] = pthread_create(&threads[t], NULL, pass, task + size * t) == 0;
+        if (!started[t]) {
+            pass(task + size * t);
+        }
+    }
+    pass(task);
+    for (int t = 1; t < ntasks; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+}
+
+// how the file just read ended its rows, so they are written back the same way
+void editorLineEnds(int crlf, int lf, int noFinalNewline) {
+    B->crlf = crlf > 0 && lf == 0;
+    B->mixedEnds = crlf > 0 && lf > 0;
+    B->noFinalNewline = noFinalNewline;
+}
+
+// a mapped file cut short by another program takes the pages past its new end with it, and
+// touching them raises SIGBUS. when the address is in a buffer's mapping, the page is
+// replaced by zeros so the access completes and the buffer is flagged. any other SIGBUS is a
+// real fault and takes the default action when the access is retried
+void editorHandleBus(int sig, siginfo_t *si, void *ctx) {
+    (void) ctx;
+    char *addr = si->si_addr;
+    struct editorBuffer *owner = NULL;
+    if (B && B->map && addr >= B->map && addr < B->map + B->mapSize) {
+        owner = B;
+    }
+    for (int j = 0; owner == NULL && j < E.nbuffers; j++) {
+        struct editorBuffer *b = E.buffers[j];
+        if (b->map && addr >= b->map && addr < b->map + b->mapSize) {
+            owner = b;
+        }
+    }
+    if (owner == NULL) {
+        signal(sig, SIG_DFL);
+        return;
+    }
+    char *page = addr - (addr - owner->map) % E.pageSize; // the mapping starts on a page
+    if (mmap(page, E.pageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        signal(sig, SIG_DFL);
+        return;
+    }
+    owner->mapLost = 1;
+    editorWake(WAKE_TASK);
+}
+
+void editorMapGuard() {
+    E.pageSize = sysconf(_SC_PAGESIZE);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = editorHandleBus;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+// say so if a buffer's file was cut short under its mapping since the last look
+void editorMapReport() {
+    for (int j = 0; j < E.nbuffers; j++) {
+        if (E.buffers[j]->mapLost) {
+            E.buffers[j]->mapLost = 0;
+            editorSetStatusMessage("%s was cut short on disk, rows past its end read as zeros",
+                    E.buffers[j]->filename);
+        }
+    }
+}
+
+// map the file and index it without copying: rows point into the mapping until edited,
+// and render/highlight are only built for rows that get drawn. the rows are only as good as
+// the file: one truncated by another program while open loses the rows past its new end,
+// which then read as zeros, see editorHandleBus
+int editorOpenMapped(int fd, size_t size) {
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    int nslices = 1;
+    if (size >= LOAD_PARALLEL_MIN_BYTES) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nslices = cpus < 1 ? 1 : (cpus > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : cpus);
+    }
+
+    struct lineScan slices[LOAD_MAX_THREADS];
+    for (int t = 0; t < nslices; t++) {
+        slices[t].map = map;
+        slices[t].from = size / nslices * t;
+        slices[t].to = (t == nslices - 1) ? size : size / nslices * (t + 1);
+        slices[t].eof = size;
+    }
+
+    editorRunParallel(editorScanCount, slices, sizeof(struct lineScan), nslices);
+
+    size_t total = 0;
+    for (int t = 0; t < nslices; t++) {
+        total += slices[t].count;
+    }
+    // lay the rows straight into full leaf blocks, then build the tree over them once
+    int nleaves = (total + ROW_LEAF_SIZE - 1) / ROW_LEAF_SIZE;
+    rowNode **leaves = malloc(sizeof(rowNode *) * nleaves);
+    for (int j = 0; j < nleaves; j++) {
+        leaves[j] = rowLeafNew();
+        leaves[j]->count = (j == nleaves - 1) ? total - (size_t) j * ROW_LEAF_SIZE : ROW_LEAF_SIZE;
+    }
+
+    size_t first = 0;
+    for (int t = 0; t < nslices; t++) {
+        slices[t].leaves = leaves;
+        slices[t].first = first;
+        first += slices[t].count;
+    }
+
+    editorRunParallel(editorScanFill, slices, sizeof(struct lineScan), nslices);
+    madvise(map, size, MADV_NORMAL);
+    int crlf = 0, lf = 0;
+    for (int t = 0; t < nslices; t++) {
+        crlf += slices[t].crlf;
+        lf += slices[t].lf;
+    }
+    editorLineEnds(crlf, lf, map[size - 1] != '\n');
+
+    B->rows = rowTreeBuild(leaves, 0, nleaves);
+    B->rowMaxLeaves = nleaves;
+    B->rowCacheLeaf = NULL;
+    free(leaves);
+
+    B->map = map;
+    B->mapSize = size;
+    B->numrows = total;
+    B->hlFrontier = 0;
+    B->hlScanned = 0;
+    return 0;
+}
+
+// load filename into the current buffer. returns -1 with errno set when it can't be opened
+int editorOpen(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    editorUndoClear();
+    free(B->filename);
+    // strdup -> makes a copy of given string, alloc memory for it, assuming you'll free it
+    B->filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+
+    B->dev = st.st_dev;
+    B->ino = st.st_ino;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (editorOpenMapped(fd, st.st_size) == 0) {
+            close(fd);
+            B->isDirty = 0;
+            journalOpen(&st);
+            return 0;
+        }
+    }
+
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) {
+        end("fdopen");
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int crlf = 0, lf = 0, ended = 1;
+
+    while((linelen = getline(&line, &linecap, fp)) != -1) {
+        ended = line[linelen - 1] == '\n';
+        if (ended && linelen > 1 && line[linelen - 2] == '\r') {
+            linelen -= 2;
+            crlf++;
+        } else if (ended) {
+            linelen--;
+            lf++;
+        }
+        editorAppendRow(B->numrows, line, linelen);
+    }
+    
+    free(line);
+    fclose(fp);
+    editorLineEnds(crlf, lf, !ended);
+    B->isDirty = 0;
+    journalOpen(&st);
+    return 0;
+}
+
+// write all n iovecs, picking up after partial writes. returns bytes written or -1
+ssize_t writevAll(int fd, struct iovec *iov, int n) {
+    ssize_t total = 0;
+    while (n > 0) {
+        ssize_t wrote = writev(fd, iov, n);
+        if (wrote == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        total += wrote;
+        // step over what went out, a partial write can stop mid iovec
+        while (n > 0 && (size_t) wrote >= iov->iov_len) {
+            wrote -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+    return total;
+}
+
+// stream the rows to fd in writev batches straight from where they live, never building a copy
+// of the file. pages of the mapping that have been written out are let go as the save moves on,
+// they fault back in from the old file if drawn again. returns bytes written or -1
+ssize_t editorWriteRows(int fd) {
+    struct iovec iov[IOV_MAX];
+    int n = 0;
+    const char *newline = B->crlf ? "\r\n" : "\n";
+    ssize_t total = 0;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t released = 0; // mapping bytes below this have been dropped
+    size_t reached = 0; // end of the furthest mapped row written so far
+
+    for (int j = 0; j < B->numrows; j++) {
+        erow *row = editorRowAt(j);
+        if (row->size > 0) {
+            iov[n].iov_base = row->chars;
+            iov[n].iov_len = row->size;
+            n++;
+            if (editorRowIsMapped(row)) {
+                reached = row->chars + row->size - B->map;
+            }
+        }
+        if (j < B->numrows - 1 || !B->noFinalNewline) {
+            iov[n].iov_base = (char *) newline;
+            iov[n].iov_len = B->crlf ? 2 : 1;
+            n++;
+        }
+
+        if (n >= IOV_MAX - 1 || j == B->numrows - 1) {
+            ssize_t wrote = writevAll(fd, iov, n);
+            if (wrote == -1) {
+                return -1;
+            }
+            total += wrote;
+            n = 0;
+
+            size_t upto = reached / page * page;
+            if (upto > released) {
+                madvise(B->map + released, upto - released, MADV_DONTNEED);
+                released = upto;
+            }
+        }
+    }
+    return total;
+}
+
+// flush a directory entry change (the rename) to disk
+void editorSyncDir(const char *path, int dirlen) {
+    char *dir = dirlen ? strndup(path, dirlen) : strdup(".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// write the buffer to B->filename. returns bytes written, or -1 with errno set
+ssize_t editorWriteFile() {
+    // write a temporary file beside the target, fsync it and rename it into place: a crash
+    // leaves the old file or the new one, never a truncated mix. a live mapping keeps the
+    // old inode around for the rows that still point into it. symlinks are followed so the
+    // file they name is replaced, not the link
+    char *target = realpath(B->filename, NULL);
+    if (target == NULL) {
+        target = strdup(B->filename);
+    }
+    char *slash = strrchr(target, '/');
+    int dirlen = slash ? slash - target + 1 : 0;
+    size_t tmplen = strlen(target) + sizeof("..XXXXXX");
+    char *tmp = malloc(tmplen);
+    snprintf(tmp, tmplen, "%.*s.%s.XXXXXX", dirlen, target, target + dirlen);
+
+    ssize_t len = -1;
+    int saved_errno = 0;
+    int fd = mkstemp(tmp);
+    if (fd != -1) {
+        struct stat st;
+        mode_t mode;
+        if (stat(target, &st) == 0) {
+            mode = st.st_mode & 07777;
+            if (fchown(fd, st.st_uid, st.st_gid) == -1) {
+                // not ours to give away, the copy stays owned by us
+            }
+        } else {
+            mode_t mask = umask(0);
+            umask(mask);
+            mode = 0644 & ~mask;
+        }
+
+        if (fchmod(fd, mode) == -1 || (len = editorWriteRows(fd)) == -1 || fsync(fd) == -1) {
+            len = -1;
+        }
+        saved_errno = errno;
+        if (close(fd) == -1 && len != -1) {
+            saved_errno = errno;
+            len = -1;
+        }
+        if (len != -1 && rename(tmp, target) == -1) {
+            saved_errno = errno;
+            len = -1;
+        }
+        if (len == -1) {
+            unlink(tmp);
+        } else {
+            editorSyncDir(target, dirlen);
+        }
+    } else {
+        saved_errno = errno;
+    }
+    free(tmp);
+    free(target);
+
+    if (len == -1) {
+        errno = saved_errno;
+        return -1;
+    }
+    struct stat st;
+    if (stat(B->filename, &st) == 0) {
+        B->dev = st.st_dev;
+        B->ino = st.st_ino;
+    }
+    B->isDirty = 0;
+    return len;
+}
+
+void saveFile() {
+    if (B->filename == NULL) {
+        B->filename = editorPrompt("Save As: %s (Press ESC to cancel)", NULL, 0);
+        if (B->filename == NULL) {
+            editorSetStatusMessage("Save Aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    struct perfSpan span = perfBegin();
+    ssize_t len = editorWriteFile();
+    perfEnd("save", &span, len);
+    if (len != -1) {
+        journalStart(0);
+        editorSetStatusMessage("%lld bytes written to disk", (long long) len);
+    } else {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    }
+}
+
+// FOLLOW
+// with -f the file is watched through inotify and only the bytes appended since the last read
+// are taken in. new rows go on the end, which leaves every row above them styled as it was.
+// while the cursor sits on the last row the view follows the end of the file, moving up
+// leaves it where it is. with -n the oldest rows are dropped so memory stays bounded, and a
+// log that is rotated away is picked up again once its name reappears
+
+int editorFollowWatch() {
+    B->follow.fd = open(B->filename, O_RDONLY);
+    if (B->follow.fd == -1) {
+        return -1;
+    }
+    B->follow.wd = inotify_add_watch(B->follow.watch, B->filename,
+            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    return 0;
+}
+
+// end the row being read at a newline, dropping a carriage return before it
+void editorFollowEndRow() {
+    erow *row = editorRowAt(B->numrows - 1);
+    if (row->size > 0 && row->chars[row->size - 1] == '\r') {
+        editorRowTruncate(B->numrows - 1, row->size - 1);
+    }
+    B->follow.partial = 0;
+}
+
+// read from offset to the end of the file into rows
+void editorFollowRead() {
+    static char buf[FOLLOW_READ_BYTES];
+    ssize_t n;
+    while ((n = pread(B->follow.fd, buf, sizeof(buf), B->follow.offset)) > 0) {
+        B->follow.offset += n;
+        const char *p = buf, *end = buf + n, *nl;
+        while (p < end) {
+            nl = memchr(p, '\n', end - p);
+            int len = (nl ? nl : end) - p;
+            if (B->follow.partial) {
+                editorRowAppendString(B->numrows - 1, (char *) p, len);
+            } else {
+                editorAppendRow(B->numrows, (char *) p, len);
+            }
+            B->follow.partial = 1;
+            if (nl) {
+                editorFollowEndRow();
+            }
+            p += len + (nl != NULL);
+        }
+    }
+}
+
+// drop the first rows, keeping the cursor and the view on the rows they were on
+void editorFollowDrop(int drop) {
+    editorDropRows(drop);
+    B->coordY = B->coordY > drop ? B->coordY - drop : 0;
+    B->rowOffset = B->rowOffset > drop ? B->rowOffset - drop : 0;
+    E.frameRowOffset -= drop;
+    // edits recorded against the dropped rows can no longer be placed
+    editorUndoClear();
+}
+
+// drop the oldest rows once there are an eighth more than maxRows, so a trim is not paid on
+// every line. pages of the mapping that no row points into any more are given back
+void editorFollowTrim() {
+    int maxRows = B->follow.maxRows;
+    if (maxRows == 0 || B->numrows <= maxRows + maxRows / 8) {
+        return;
+    }
+    editorFollowDrop(B->numrows - maxRows);
+
+    erow *first = editorRowAt(0);
+    if (editorRowIsMapped(first)) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t upto = (first->chars - B->map) / page * page;
+        if (upto > B->follow.released) {
+            madvise(B->map + B->follow.released, upto - B->follow.released, MADV_DONTNEED);
+            B->follow.released = upto;
+        }
+    }
+}
+
+// the file was truncated under its mapping, the pages past its new end are gone and touching
+// them is a SIGBUS. the rows loaded through the mapping are dropped, up to the last one still
+// pointing into it, and the mapping is let go. rows read since stay
+void editorFollowUnmap() {
+    if (B->map == NULL) {
+        return;
+    }
+    int last = -1;
+    for (int j = 0; j < B->numrows; j++) {
+        if (editorRowIsMapped(editorRowAt(j))) {
+            last = j;
+        }
+    }
+    if (last >= 0) {
+        editorFollowDrop(last + 1);
+    }
+    munmap(B->map, B->mapSize);
+    B->map = NULL;
+    B->mapSize = 0;
+    B->follow.released = 0;
+}
+
+// start following B->filename, just opened. maxRows of 0 keeps every row
+void editorFollowStart(int maxRows) {
+    B->follow.maxRows = maxRows;
+    B->follow.watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (B->follow.watch == -1 || editorFollowWatch() == -1) {
+        editorSetStatusMessage("Can't follow %s: %s", B->filename, strerror(errno));
+        B->follow.on = 0;
+        return;
+    }
+    // pick up where the mapping ends. a file that was not mapped is read again from the start
+    if (B->map) {
+        B->follow.offset = B->mapSize;
+        B->follow.partial = B->map[B->mapSize - 1] != '\n';
+    } else {
+        editorFreeRows();
+        B->follow.offset = 0;
+        B->follow.partial = 0;
+    }
+    B->follow.released = 0;
+    B->follow.on = 1;
+    editorFollowRead();
+    editorFollowTrim();
+    B->coordY = B->numrows > 0 ? B->numrows - 1 : 0;
+    B->isDirty = 0;
+}
+
+// the name no longer leads to the file being read: it was rotated or removed
+int editorFollowMoved() {
+    struct stat now, cur;
+    return stat(B->filename, &now) == -1 || fstat(B->follow.fd, &cur) == -1 ||
+            now.st_ino != cur.st_ino || now.st_dev != cur.st_dev;
+}
+
+// take in whatever was appended since the last call. returns 1 when rows changed
+int editorFollowPoll() {
+    if (!B->follow.on || E.prompting) {
+        return 0;
+    }
+    int numrows = B->numrows;
+    int pinned = B->coordY >= B->numrows - 1;
+    int dirty = B->isDirty;
+    int changed = 0;
+
+    if (B->follow.fd == -1) {
+        // waiting for a rotated log to come back under its name
+        if (editorFollowWatch() == -1) {
+            return 0;
+        }
+        B->follow.offset = 0;
+        editorSetStatusMessage("%s reappeared, following the new file", B->filename);
+        changed = 1;
+    } else {
+        char events[4096];
+        if (read(B->follow.watch, events, sizeof(events)) <= 0) {
+            return 0;
+        }
+    }
+
+    struct stat st;
+    if (fstat(B->follow.fd, &st) == 0 && st.st_size < B->follow.offset) {
+        // truncated in place: carry on from its new start, on a row of its own
+        editorFollowUnmap();
+        B->follow.offset = 0;
+        B->follow.partial = 0;
+        editorSetStatusMessage("%s was truncated", B->filename);
+        changed = 1;
+    }
+    editorFollowRead();
+    if (editorFollowMoved()) {
+        inotify_rm_watch(B->follow.watch, B->follow.wd);
+        close(B->follow.fd);
+        B->follow.fd = -1;
+        B->follow.partial = 0;
+        editorSetStatusMessage("%s went away, waiting for it to return", B->filename);
+        changed = 1;
+    }
+
+    if (B->numrows != numrows || changed) {
+        if (pinned) {
+            B->coordY = B->numrows > 0 ? B->numrows - 1 : 0;
+            B->coordX = 0;
+        }
+        editorFollowTrim();
+        B->isDirty = dirty;
+        return 1;
+    }
+    B->isDirty = dirty;
+    return 0;
+}
+
+// BUFFERS
+// every open file has an editorBuffer of its own and B points at the one being edited. rows,
+// undo history and the swap journal live in the buffer, while the slabs, the render cache and
+// the compiled syntax tables are shared between buffers. switching is a pointer swap, so a buffer comes back
+// with its cursor, view and cached renders as it was left. opening a file that is already
+// open goes to its buffer rather than loading it twice
+
+struct editorBuffer *editorBufferNew() {
+    struct editorBuffer *b = calloc(1, sizeof(struct editorBuffer));
+    b->undoLast = -1;
+    b->undoBroken = 1;
+    b->journal.fd = -1;
+    b->follow.fd = -1;
+    return b;
+}
+
+void editorBufferSwitch(int index) {
+    E.current = index;
+    B = E.buffers[index];
+    // the screen changes to another buffer, there is nothing to scroll
+    E.frameRowOffset = B->rowOffset;
+}
+
+// open an empty buffer and make it current
+void editorBufferAdd() {
+    E.buffers = realloc(E.buffers, sizeof(struct editorBuffer *) * (E.nbuffers + 1));
+    E.buffers[E.nbuffers++] = editorBufferNew();
+    editorBufferSwitch(E.nbuffers - 1);
+    journalInit();
+}
+
+// edit filename: the buffer that has it open already, or a new one. an untouched empty buffer,
+// as a bare start leaves, is used for it. returns -1 with errno set when it can't be opened
+int editorBufferOpen(char *filename) {
+    struct stat st;
+    if (stat(filename, &st) == -1) {
+        return -1;
+    }
+    for (int j = 0; j < E.nbuffers; j++) {
+        struct editorBuffer *b = E.buffers[j];
+        if (b->filename && b->dev == st.st_dev && b->ino == st.st_ino) {
+            editorBufferSwitch(j);
+            editorSetStatusMessage("%s is already open", filename);
+            return 0;
+        }
+    }
+
+    int reuse = B && B->filename == NULL && B->numrows == 0 && !B->isDirty;
+    if (!reuse) {
+        editorBufferAdd();
+    }
+    if (editorOpen(filename) == -1) {
+        int saved_errno = errno;
+        if (!reuse) {
+            editorBufferClose();
+        }
+        errno = saved_errno;
+        return -1;
+    }
+    editorSyntaxLoaded();
+    return 0;
+}
+
+// let go of everything the current buffer holds, and the buffer. B is left dangling
+void editorBufferFree() {
+    journalStop(1);
+    if (B->follow.on) {
+        if (B->follow.fd != -1) {
+            close(B->follow.fd);
+        }
+        close(B->follow.watch);
+    }
+    editorFreeRows();
+    editorUndoClear();
+    if (B->map) {
+        munmap(B->map, B->mapSize);
+    }
+    free(B->filename);
+    free(B->journal.pending);
+    if (B->journal.ready) {
+        pthread_mutex_destroy(&B->journal.lock);
+        pthread_cond_destroy(&B->journal.wake);
+    }
+    free(B);
+}
+
+// close the current buffer, its edits and swap file go with it. closing the last one leaves an
+// empty buffer
+void editorBufferClose() {
+    editorBufferFree();
+    E.nbuffers--;
+    memmove(&E.buffers[E.current], &E.buffers[E.current + 1], sizeof(struct editorBuffer *) * (E.nbuffers - E.current));
+    if (E.nbuffers == 0) {
+        editorBufferAdd();
+    } else {
+        editorBufferSwitch(E.current < E.nbuffers ? E.current : E.nbuffers - 1);
+    }
+}
+
+void editorBufferOpenPrompt() {
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL, 0);
+    if (filename == NULL) {
+        editorSetStatusMessage("Open aborted");
+        return;
+    }
+    if (editorBufferOpen(filename) == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+    }
+    free(filename);
+}
+
+void editorBufferNext(int dir) {
+    editorBufferSwitch((E.current + dir + E.nbuffers) % E.nbuffers);
+    editorSetStatusMessage("%s", B->filename ? B->filename : "[No Name]");
+}
+
+// any buffer with edits not saved
+int editorBuffersDirty() {
+    for (int j = 0; j < E.nbuffers; j++) {
+        if (E.buffers[j]->isDirty) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void abAppend(struct abuf *ab, const char*s, int len) {
+    if (len == 0) {
+        return; // b may not exist yet, and memcpy takes no NULL even for nothing
+    }
+    if (ab->len + len > ab->cap) {
+        // grow geometrically so a frame costs a handful of reallocs at most, then none
+        int cap = ab->cap ? ab->cap : ABUF_MIN_CAP;
+        while (cap < ab->len + len) {
+            cap *= 2;
+        }
+        char *new = realloc(ab->b, cap);
+        if (new == NULL) {
+            return;
+        }
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(&ab->b[ab->len], s, len);
+    ab->len += len;
+}
+
+void abPushPiece(struct abuf *ab, const char *ext, int off, int len) {
+    if (ab->npieces == ab->piecesCap) {
+        int cap = ab->piecesCap ? ab->piecesCap * 2 : 64;
+        struct abufPiece *new = realloc(ab->pieces, sizeof(struct abufPiece) * cap);
+        if (new == NULL) {
+            return;
+        }
+        ab->pieces = new;
+        ab->piecesCap = cap;
+    }
+    ab->pieces[ab->npieces].ext = ext;
+    ab->pieces[ab->npieces].off = off;
+    ab->pieces[ab->npieces].len = len;
+    ab->npieces++;
+}
+
+// close off the bytes copied since the last piece
+void abSeal(struct abuf *ab) {
+    if (ab->len > ab->sealed) {
+        abPushPiece(ab, NULL, ab->sealed, ab->len - ab->sealed);
+        ab->sealed = ab->len;
+    }
+}
+
+// queue bytes that stay where they are until abWrite. s must outlive the write
+void abAppendRef(struct abuf *ab, const char *s, int len) {
+    abSeal(ab);
+    abPushPiece(ab, s, 0, len);
+}
+
+// send every piece in order, as few writev calls as IOV_MAX allows. returns bytes written
+ssize_t abWrite(struct abuf *ab, int fd) {
+    struct iovec iov[IOV_MAX];
+    ssize_t total = 0;
+    int next = 0;
+
+    abSeal(ab);
+    while (next < ab->npieces) {
+        int n = 0;
+        while (n < IOV_MAX && next + n < ab->npieces) {
+            struct abufPiece *piece = &ab->pieces[next + n];
+            iov[n].iov_base = (void *) (piece->ext ? piece->ext : &ab->b[piece->off]);
+            iov[n].iov_len = piece->len;
+            n++;
+        }
+        next += n;
+
+        ssize_t wrote = writevAll(fd, iov, n);
+        if (wrote == -1) {
+            return -1;
+        }
+        total += wrote;
+    }
+    return total;
+}
+
+// empty the buffer for the next frame, keeping its memory
+void abReset(struct abuf *ab) {
+    ab->len = 0;
+    ab->sealed = 0;
+    ab->npieces = 0;
+}
+
+void abFree(struct abuf *ab) {
+    free(ab->b);
+    free(ab->pieces);
+}
+
+
+// INPUT
+// read a line on the status bar. Enter on an empty line is ignored unless allowEmpty
+char *editorPrompt(char *prompt, void (*callback)(char *, int), int allowEmpty) {
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    E.prompting = 1;
+
+    size_t buflen = 0;
+    buf[0] = '\0';
+
+    while (1) {
+        editorSetStatusMessage(prompt, buf);
+        editorRefreshScreen();
+
+        int c = editorReadKey();
+
+        // allow special keys in prompt
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+            if (buflen != 0) {
+                buf[--buflen] = '\0';
+            }
+        } else if (c == '\x1b') {
+            editorSetStatusMessage("");
+            if (callback) {
+                callback(buf, c);
+            }
+            free(buf);
+            E.prompting = 0;
+            return NULL;
+        } else if (c == '\r') {
+            if (buflen != 0 || allowEmpty) {
+                editorSetStatusMessage("");
+                if (callback) {
+                    callback(buf, c);
+                }
+                E.prompting = 0;
+                return buf;
+            }
+        } else if (!iscntrl(c) && c < 128) {
+            if (buflen == bufsize - 1) {
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        } else if (c == PASTE_BEGIN) {
+            // a paste fills in its first line
+            struct abuf ab = ABUF_INIT;
+            editorReadPaste(&ab);
+            for (int j = 0; j < ab.len && ab.b[j] != '\n'; j++) {
+                if (iscntrl((unsigned char) ab.b[j])) {
+                    continue;
+                }
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = ab.b[j];
+            }
+            buf[buflen] = '\0';
+            abFree(&ab);
+        }
+        if (callback) {
+            callback(buf, c);
+        }
+    }
+}
+
+
+// REGEX
+// patterns are parsed into a tree, compiled to a Thompson NFA, and matched through a DFA whose
+// states (ordered sets of NFA threads) are only built when the text reaches them. matching is
+// linear in the text whatever the pattern. supported: literals, . [] [^] \d \w \s and their
+// negations, * + ? (and lazy *? +? ??), | () ^ $, all relative to one row
+enum regexOp {
+    RE_CLASS,
+    RE_EMPTY,
+    RE_CAT,
+    RE_ALT,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST,
+    RE_BOL,
+    RE_EOL
+};
+
+struct regexNode {
+    int op;
+    int greedy;
+    struct regexNode *left, *right;
+    unsigned char set[32]; // RE_CLASS: bit per byte
+};
+
+struct regexParser {
+    const char *p;
+    struct regexNode *pool;
+    int used, cap;
+    int depth;
+    int error;
+};
+
+enum regexInstOp {
+    RI_CLASS,
+    RI_SPLIT, // out is preferred over out1
+    RI_JMP,
+    RI_BOL,
+    RI_EOL,
+    RI_MATCH
+};
+
+struct regexInst {
+    int op;
+    int out, out1;
+    unsigned char set[32];
+};
+
+struct dfaState {
+    int list; // offset of its NFA threads in lists, in priority order
+    int n;
+    int match; // a thread has matched
+    int endMatch; // matches if the text ends here: -1 not worked out yet
+};
+
+// one direction of a compiled pattern with its lazily built DFA
+struct regexProg {
+    struct regexInst *inst;
+    int ninst;
+    int cut; // leftmost-first: a match drops the lower priority threads (forward search)
+    unsigned char classOf[256]; // bytes no instruction tells apart share a DFA column
+    int classes;
+    struct dfaState *states;
+    int nstates;
+    int *trans; // nstates * classes, DFA_UNKNOWN until the step is taken once
+    int *lists;
+    int listsLen, listsCap;
+    int *hash; // REGEX_DFA_HASH slots of state ids, -1 empty
+    int startState[2]; // [at row start]
+    int *stack, *scratch;
+    unsigned int *mark;
+    unsigned int markGen;
+};
+
+struct regex {
+    struct regexProg fwd; // unanchored, finds where the leftmost match ends
+    struct regexProg rev; // the pattern reversed, walks back from that end to its start
+};
+
+#define CLASS_HAS(set, c) ((set)[(unsigned char) (c) >> 3] & (1 << ((unsigned char) (c) & 7)))
+#define CLASS_ADD(set, c) ((set)[(unsigned char) (c) >> 3] |= (1 << ((unsigned char) (c) & 7)))
+
+struct regexNode *regexNode(struct regexParser *ps, int op, struct regexNode *left, struct regexNode *right) {
+    if (ps->used == ps->cap) {
+        ps->error = 1;
+        return NULL;
+    }
+    struct regexNode *node = &ps->pool[ps->used++];
+    memset(node, 0, sizeof(*node));
+    node->op = op;
+    node->greedy = 1;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+void regexClassRange(unsigned char *set, int from, int to) {
+    for (int c = from; c <= to; c++) {
+        CLASS_ADD(set, c);
+    }
+}
+
+// \d \w \s and friends into set, anything else stands for itself
+void regexEscape(unsigned char *set, char e) {
+    unsigned char cls[32];
+    memset(cls, 0, sizeof(cls));
+    switch (e) {
+        case 'd':
+        case 'D':
+            regexClassRange(cls, '0', '9');
+            break;
+        case 'w':
+        case 'W':
+            regexClassRange(cls, '0', '9');
+            regexClassRange(cls, 'a', 'z');
+            regexClassRange(cls, 'A', 'Z');
+            CLASS_ADD(cls, '_');
+            break;
+        case 's':
+        case 'S':
+            CLASS_ADD(cls, ' ');
+            regexClassRange(cls, '\t', '\r');
+            break;
+        case 't':
+            CLASS_ADD(set, '\t');
+            return;
+        case 'n':
+            CLASS_ADD(set, '\n');
+            return;
+        case 'r':
+            CLASS_ADD(set, '\r');
+            return;
+        default:
+            CLASS_ADD(set, e);
+            return;
+    }
+    int negate = isupper((unsigned char) e);
+    for (int j = 0; j < 32; j++) {
+        set[j] |= negate ? (unsigned char) ~cls[j] : cls[j];
+    }
+}
+
+struct regexNode *regexParseAlt(struct regexParser *ps);
+
+struct regexNode *regexParseClass(struct regexParser *ps) {
+    struct regexNode *node = regexNode(ps, RE_CLASS, NULL, NULL);
+    if (node == NULL) {
+        return NULL;
+    }
+    int negate = *ps->p == '^';
+    if (negate) {
+        ps->p++;
+    }
+    int first = 1;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = 0;
+        int c = (unsigned char) *ps->p++;
+        if (c == '\\') {
+            if (*ps->p == '\0') {
+                break;
+            }
+            regexEscape(node->set, *ps->p++);
+            continue;
+        }
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            int to = (unsigned char) ps->p[1];
+            ps->p += 2;
+            if (to < c) {
+                ps->error = 1;
+                return NULL;
+            }
+            regexClassRange(node->set, c, to);
+        } else {
+            CLASS_ADD(node->set, c);
+        }
+    }
+    if (*ps->p != ']') {
+        ps->error = 1;
+        return NULL;
+    }
+    ps->p++;
+    if (negate) {
+        for (int j = 0; j < 32; j++) {
+            node->set[j] = ~node->set[j];
+        }
+    }
+    return node;
+}
+
+struct regexNode *regexParseAtom(struct regexParser *ps) {
+    char c = *ps->p++;
+    struct regexNode *node;
+
+    switch (c) {
+        case '(':
+            if (++ps->depth > 1000) {
+                ps->error = 1;
+                return NULL;
+            }
+            node = regexParseAlt(ps);
+            ps->depth--;
+            if (*ps->p != ')') {
+                ps->error = 1;
+                return NULL;
+            }
+            ps->p++;
+            return node;
+        case '[':
+            return regexParseClass(ps);
+        case '^':
+            return regexNode(ps, RE_BOL, NULL, NULL);
+        case '$':
+            return regexNode(ps, RE_EOL, NULL, NULL);
+        case '*':
+        case '+':
+        case '?':
+            ps->error = 1; // nothing to repeat
+            return NULL;
+    }
+
+    node = regexNode(ps, RE_CLASS, NULL, NULL);
+    if (node == NULL) {
+        return NULL;
+    }
+    if (c == '.') {
+        memset(node->set, 0xff, sizeof(node->set));
+    } else if (c == '\\') {
+        if (*ps->p == '\0') {
+            ps->error = 1;
+            return NULL;
+        }
+        regexEscape(node->set, *ps->p++);
+    } else {
+        CLASS_ADD(node->set, c);
+    }
+    return node;
+}
+
+struct regexNode *regexParseRepeat(struct regexParser *ps) {
+    struct regexNode *node = regexParseAtom(ps);
+    while (!ps->error && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?')) {
+        char c = *ps->p++;
+        node = regexNode(ps, c == '*' ? RE_STAR : c == '+' ? RE_PLUS : RE_QUEST, node, NULL);
+        if (node && *ps->p == '?') {
+            node->greedy = 0;
+            ps->p++;
+        }
+    }
+    return node;
+}
+
+struct regexNode *regexParseCat(struct regexParser *ps) {
+    struct regexNode *node = NULL;
+    while (!ps->error && *ps->p && *ps->p != '|' && *ps->p != ')') {
+        struct regexNode *next = regexParseRepeat(ps);
+        node = node ? regexNode(ps, RE_CAT, node, next) : next;
+    }
+    return node ? node : regexNode(ps, RE_EMPTY, NULL, NULL);
+}
+
+struct regexNode *regexParseAlt(struct regexParser *ps) {
+    struct regexNode *node = regexParseCat(ps);
+    while (!ps->error && *ps->p == '|') {
+        ps->p++;
+        node = regexNode(ps, RE_ALT, node, regexParseCat(ps));
+    }
+    return node;
+}
+
+// instructions the node compiles to
+int regexSize(struct regexNode *node) {
+    switch (node->op) {
+        case RE_EMPTY:
+            return 0;
+        case RE_CAT:
+            return regexSize(node->left) + regexSize(node->right);
+        case RE_ALT:
+        case RE_STAR:
+            return 2 + regexSize(node->left) + (node->right ? regexSize(node->right) : 0);
+        case RE_PLUS:
+        case RE_QUEST:
+            return 1 + regexSize(node->left);
+        default:
+            return 1;
+    }
+}
+
+int regexEmitInst(struct regexProg *prog, int op) {
+    int pc = prog->ninst++;
+    memset(&prog->inst[pc], 0, sizeof(struct regexInst));
+    prog->inst[pc].op = op;
+    prog->inst[pc].out = pc + 1;
+    return pc;
+}
+
+// append node's instructions. reversed, concatenations run back to front and ^/$ trade places
+void regexEmit(struct regexProg *prog, struct regexNode *node, int reverse) {
+    int split, jmp, start;
+
+    switch (node->op) {
+        case RE_EMPTY:
+            break;
+        case RE_CLASS:
+            memcpy(prog->inst[regexEmitInst(prog, RI_CLASS)].set, node->set, 32);
+            break;
+        case RE_BOL:
+        case RE_EOL:
+            regexEmitInst(prog, (node->op == RE_BOL) != reverse ? RI_BOL : RI_EOL);
+            break;
+        case RE_CAT:
+            regexEmit(prog, reverse ? node->right : node->left, reverse);
+            regexEmit(prog, reverse ? node->left : node->right, reverse);
+            break;
+        case RE_ALT:
+            split = regexEmitInst(prog, RI_SPLIT);
+            regexEmit(prog, node->left, reverse);
+            jmp = regexEmitInst(prog, RI_JMP);
+            prog->inst[split].out1 = prog->ninst;
+            regexEmit(prog, node->right, reverse);
+            prog->inst[jmp].out = prog->ninst;
+            break;
+        case RE_STAR:
+            split = regexEmitInst(prog, RI_SPLIT);
+            regexEmit(prog, node->left, reverse);
+            jmp = regexEmitInst(prog, RI_JMP);
+            prog->inst[jmp].out = split;
+            prog->inst[split].out = node->greedy ? split + 1 : prog->ninst;
+            prog->inst[split].out1 = node->greedy ? prog->ninst : split + 1;
+            break;
+        case RE_PLUS:
+            start = prog->ninst;
+            regexEmit(prog, node->left, reverse);
+            split = regexEmitInst(prog, RI_SPLIT);
+            prog->inst[split].out = node->greedy ? start : split + 1;
+            prog->inst[split].out1 = node->greedy ? split + 1 : start;
+            break;
+        case RE_QUEST:
+            split = regexEmitInst(prog, RI_SPLIT);
+            regexEmit(prog, node->left, reverse);
+            prog->inst[split].out = node->greedy ? split + 1 : prog->ninst;
+            prog->inst[split].out1 = node->greedy ? prog->ninst : split + 1;
+            break;
+    }
+}
+
+void regexProgFlush(struct regexProg *prog) {
+    prog->nstates = 0;
+    prog->listsLen = 0;
+    prog->startState[0] = prog->startState[1] = DFA_UNKNOWN;
+    for (int j = 0; j < REGEX_DFA_HASH; j++) {
+        prog->hash[j] = -1;
+    }
+}
+
+// compile node into prog. the forward program is prefixed with a lazy .*? so it finds matches
+// anywhere, the reverse one is anchored where the walk back starts
+void regexProgInit(struct regexProg *prog, struct regexNode *node, int reverse) {
+    memset(prog, 0, sizeof(*prog));
+    prog->inst = malloc(sizeof(struct regexInst) * (regexSize(node) + 3));
+    prog->cut = !reverse;
+    if (!reverse) {
+        int split = regexEmitInst(prog, RI_SPLIT);
+        int any = regexEmitInst(prog, RI_CLASS);
+        memset(prog->inst[any].set, 0xff, 32);
+        prog->inst[any].out = split;
+        prog->inst[split].out = split + 2;
+        prog->inst[split].out1 = any;
+    }
+    regexEmit(prog, node, reverse);
+    regexEmitInst(prog, RI_MATCH);
+
+    // split the bytes into classes that every instruction treats alike
+    memset(prog->classOf, 0, sizeof(prog->classOf));
+    prog->classes = 1;
+    for (int pc = 0; pc < prog->ninst; pc++) {
+        if (prog->inst[pc].op != RI_CLASS) {
+            continue;
+        }
+        int remap[2][256];
+        memset(remap, -1, sizeof(remap));
+        int classes = 0;
+        for (int c = 0; c < 256; c++) {
+            int in = CLASS_HAS(prog->inst[pc].set, c) ? 1 : 0;
+            int *to = &remap[in][prog->classOf[c]];
+            if (*to == -1) {
+                *to = classes++;
+            }
+            prog->classOf[c] = *to;
+        }
+        prog->classes = classes;
     }
 
-    E.row[at].idx = at;
-
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-
-    E.row[at].renderSize = 0;
-    E.row[at].render = NULL;
-    E.row[at].highlight = NULL;
-    E.row[at].hl_open_comment = 0;
-    editorUpdateRow(&E.row[at]);
-
-    E.numrows++;
-    E.isDirty = 1;
+    prog->stack = malloc(sizeof(int) * (2 * prog->ninst + 1));
+    prog->scratch = malloc(sizeof(int) * prog->ninst);
+    prog->mark = calloc(prog->ninst, sizeof(unsigned int));
+    prog->states = malloc(sizeof(struct dfaState) * REGEX_DFA_MAX_STATES);
+    prog->trans = malloc(sizeof(int) * REGEX_DFA_MAX_STATES * prog->classes);
+    prog->hash = malloc(sizeof(int) * REGEX_DFA_HASH);
+    prog->listsCap = 1024;
+    prog->lists = malloc(sizeof(int) * prog->listsCap);
+    regexProgFlush(prog);
 }
 
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->highlight);
+void regexProgFree(struct regexProg *prog) {
+    free(prog->inst);
+    free(prog->stack);
+    free(prog->scratch);
+    free(prog->mark);
+    free(prog->states);
+    free(prog->trans);
+    free(prog->hash);
+    free(prog->lists);
 }
 
-void editorDelRow(int at) {
-    if (at < 0 || at >= E.numrows) {
-        return;
-    }
-
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    
-    for (int j = at; j < E.numrows - 1; j++) {
-        E.row[j].idx--;
+struct regex *regexCompile(const char *pattern) {
+    struct regexParser ps;
+    ps.p = pattern;
+    ps.cap = 4 * strlen(pattern) + 4;
+    ps.pool = malloc(sizeof(struct regexNode) * ps.cap);
+    ps.used = 0;
+    ps.depth = 0;
+    ps.error = 0;
+
+    struct regexNode *root = regexParseAlt(&ps);
+    if (ps.error || root == NULL || *ps.p != '\0') {
+        free(ps.pool);
+        return NULL;
     }
-    
-    E.numrows--;
-    E.isDirty = 1;
+    struct regex *re = malloc(sizeof(struct regex));
+    regexProgInit(&re->fwd, root, 0);
+    regexProgInit(&re->rev, root, 1);
+    free(ps.pool);
+    return re;
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
-    if (at < 0 || at > row->size) {
-        at = row->size;
+void regexFree(struct regex *re) {
+    if (re) {
+        regexProgFree(&re->fwd);
+        regexProgFree(&re->rev);
+        free(re);
     }
+}
 
-    row->chars = realloc(row->chars, row->size + 2);
+// append the threads reachable from pc without reading a byte, in priority order. a thread
+// waiting on $ away from the end is kept for regexEndMatch. returns 0 when a match cut the rest
+int regexClosure(struct regexProg *prog, int pc, int atStart, int atEnd, int *out, int *n) {
+    int sp = 0;
+    prog->stack[sp++] = pc;
+    while (sp > 0) {
+        pc = prog->stack[--sp];
+        if (prog->mark[pc] == prog->markGen) {
+            continue;
+        }
+        prog->mark[pc] = prog->markGen;
 
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.isDirty = 1;
+        struct regexInst *inst = &prog->inst[pc];
+        switch (inst->op) {
+            case RI_SPLIT:
+                prog->stack[sp++] = inst->out1;
+                prog->stack[sp++] = inst->out;
+                break;
+            case RI_JMP:
+                prog->stack[sp++] = inst->out;
+                break;
+            case RI_BOL:
+                if (atStart) {
+                    prog->stack[sp++] = inst->out;
+                }
+                break;
+            case RI_EOL:
+                if (atEnd) {
+                    prog->stack[sp++] = inst->out;
+                } else {
+                    out[(*n)++] = pc;
+                }
+                break;
+            case RI_MATCH:
+                out[(*n)++] = pc;
+                if (prog->cut) {
+                    return 0;
+                }
+                break;
+            default:
+                out[(*n)++] = pc;
+        }
+    }
+    return 1;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.isDirty = 1;
+void regexNewGen(struct regexProg *prog) {
+    if (++prog->markGen == 0) {
+        memset(prog->mark, 0, sizeof(unsigned int) * prog->ninst);
+        prog->markGen = 1;
+    }
 }
 
-void editorRowDelChar(erow *row, int at) {
-    if (at < 0 || at >= row-> size) {
-        return;
+// the DFA state for this list of threads, made when new. the cache is emptied when full, so
+// ids from before the call may be stale: *flushed says so
+int regexIntern(struct regexProg *prog, int *list, int n, int *flushed) {
+    if (n == 0) {
+        return DFA_DEAD;
+    }
+    unsigned int h = 2166136261u;
+    for (int j = 0; j < n; j++) {
+        h = (h ^ (unsigned int) list[j]) * 16777619u;
+    }
+    unsigned int slot = h & (REGEX_DFA_HASH - 1);
+    for (; prog->hash[slot] != -1; slot = (slot + 1) & (REGEX_DFA_HASH - 1)) {
+        struct dfaState *st = &prog->states[prog->hash[slot]];
+        if (st->n == n && memcmp(&prog->lists[st->list], list, sizeof(int) * n) == 0) {
+            return prog->hash[slot];
+        }
     }
-    // overwrite deleted character with what comes after
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.isDirty = 1;
-}
 
-void editorDeleteChar() {
-    if (E.coordY == E.numrows) {
-        return;
+    if (prog->nstates == REGEX_DFA_MAX_STATES) {
+        regexProgFlush(prog);
+        *flushed = 1;
+        slot = h & (REGEX_DFA_HASH - 1);
     }
-    // do nothing if at start of first line
-    if (E.coordX == 0 && E.coordY == 0) {
-        return;
+    if (prog->listsLen + n > prog->listsCap) {
+        while (prog->listsLen + n > prog->listsCap) {
+            prog->listsCap *= 2;
+        }
+        prog->lists = realloc(prog->lists, sizeof(int) * prog->listsCap);
     }
 
-    erow *row = &E.row[E.coordY];
+    int id = prog->nstates++;
+    struct dfaState *st = &prog->states[id];
+    st->list = prog->listsLen;
+    st->n = n;
+    st->match = 0;
+    st->endMatch = -1;
+    memcpy(&prog->lists[st->list], list, sizeof(int) * n);
+    prog->listsLen += n;
+    for (int j = 0; j < n; j++) {
+        if (prog->inst[list[j]].op == RI_MATCH) {
+            st->match = 1;
+        }
+    }
+    for (int c = 0; c < prog->classes; c++) {
+        prog->trans[id * prog->classes + c] = DFA_UNKNOWN;
+    }
+    prog->hash[slot] = id;
+    return id;
+}
 
-    if (E.coordX > 0) {
-        editorRowDelChar(row, E.coordX - 1);
-        E.coordX--;
-    } else {
-        E.coordX = E.row[E.coordY - 1].size;
-        editorRowAppendString(&E.row[E.coordY - 1], row->chars, row->size);
-        editorDelRow(E.coordY);
-        E.coordY--;
+int regexStart(struct regexProg *prog, int atStart) {
+    if (prog->startState[atStart] == DFA_UNKNOWN) {
+        int n = 0, flushed = 0;
+        regexNewGen(prog);
+        regexClosure(prog, 0, atStart, 0, prog->scratch, &n);
+        prog->startState[atStart] = regexIntern(prog, prog->scratch, n, &flushed);
     }
+    return prog->startState[atStart];
 }
 
-// ops
+// the state after reading c in state from
+int regexStep(struct regexProg *prog, int from, unsigned char c) {
+    int cls = prog->classOf[c];
+    int next = prog->trans[from * prog->classes + cls];
+    if (next != DFA_UNKNOWN) {
+        return next;
+    }
 
-void editorInsertChar(int c) {
-    if (E.coordY == E.numrows) {
-        editorAppendRow(E.numrows, "", 0);
+    int n = 0, flushed = 0;
+    struct dfaState *st = &prog->states[from];
+    regexNewGen(prog);
+    for (int j = 0; j < st->n; j++) {
+        struct regexInst *inst = &prog->inst[prog->lists[st->list + j]];
+        if (inst->op == RI_MATCH && prog->cut) {
+            break;
+        }
+        if (inst->op == RI_CLASS && CLASS_HAS(inst->set, c)) {
+            if (!regexClosure(prog, inst->out, 0, 0, prog->scratch, &n)) {
+                break;
+            }
+        }
     }
-    editorRowInsertChar(&E.row[E.coordY], E.coordX, c);
-    E.coordX++;
+    next = regexIntern(prog, prog->scratch, n, &flushed);
+    if (!flushed) {
+        prog->trans[from * prog->classes + cls] = next;
+    }
+    return next;
 }
 
-void editorInsertNewline() {
-    // if at start of line, just append a blank row
-    if (E.coordX == 0) {
-        editorAppendRow(E.coordY, "", 0);
-    } else {
-        // otherwise, split current line and pass rightward chars to the new row
-        erow *row = &E.row[E.coordY]; // reassign the pointer to keep it from being invalidated
-        editorAppendRow(E.coordY + 1, &row->chars[E.coordX], row->size - E.coordX);
-        row = &E.row[E.coordY];
-        row->size = E.coordX;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+// whether the state matches when the text ends right here, letting $ through
+int regexEndMatch(struct regexProg *prog, int id) {
+    struct dfaState *st = &prog->states[id];
+    if (st->endMatch == -1) {
+        st->endMatch = st->match;
+        for (int j = 0; j < st->n && !st->endMatch; j++) {
+            struct regexInst *inst = &prog->inst[prog->lists[st->list + j]];
+            if (inst->op == RI_EOL) {
+                int n = 0;
+                regexNewGen(prog);
+                regexClosure(prog, inst->out, 0, 1, prog->scratch, &n);
+                for (int k = 0; k < n; k++) {
+                    if (prog->inst[prog->scratch[k]].op == RI_MATCH) {
+                        st->endMatch = 1;
+                    }
+                }
+            }
+        }
     }
-    E.coordY++;
-    E.coordX = 0;
+    return st->endMatch;
 }
 
-// file handling
-
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
-    int j;
-    for (j = 0; j < E.numrows; j++) {
-        totlen += E.row[j].size + 1;
+// leftmost match in s[from, len): returns where it ends and sets *start, or -1 for none.
+// the forward DFA finds the end, the reverse one walks back to the earliest start
+int regexFind(struct regex *re, const char *s, int len, int from, int *start) {
+    struct regexProg *prog = &re->fwd;
+    int state = regexStart(prog, from == 0);
+    int end = prog->states[state].match ? from : -1;
+    int i;
+    for (i = from; i < len; i++) {
+        state = regexStep(prog, state, s[i]);
+        if (state == DFA_DEAD) {
+            break;
+        }
+        if (prog->states[state].match) {
+            end = i + 1;
+        }
     }
-    *buflen = totlen;
-
-    char *buf = malloc(totlen);
-    char *p = buf;
-
-    for (j = 0; j < E.numrows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+    if (i == len && state != DFA_DEAD && regexEndMatch(prog, state)) {
+        end = len;
+    }
+    if (end == -1) {
+        return -1;
     }
 
-    return buf;
+    prog = &re->rev;
+    state = regexStart(prog, end == len);
+    *start = prog->states[state].match ? end : -1;
+    for (i = end - 1; i >= from; i--) {
+        state = regexStep(prog, state, s[i]);
+        if (state == DFA_DEAD) {
+            break;
+        }
+        if (prog->states[state].match) {
+            *start = i;
+        }
+    }
+    if (i < 0 && state != DFA_DEAD && regexEndMatch(prog, state)) {
+        *start = 0;
+    }
+    if (*start == -1) {
+        *start = end;
+    }
+    return end;
 }
 
-void editorOpen(char *filename) {
-    free(E.filename);
-    // strdup -> makes a copy of given string, alloc memory for it, assuming you'll free it
-    E.filename = strdup(filename);
-
-    editorSelectSyntaxHighlight();
-
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        end("fopen");
+// first occurrence of needle in s. with SSE2, 16 candidate positions are tested at once on the
+// needle's first and last byte and only positions where both agree are compared in full;
+// otherwise memchr finds the first byte
+const char *editorFindBytes(const char *s, size_t len, const char *needle, size_t n) {
+    if (n == 0 || n > len) {
+        return NULL;
+    }
+    if (n == 1) {
+        return memchr(s, needle[0], len);
     }
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-
-    while((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
-            linelen--;
+    size_t i = 0;
+#ifdef SEARCH_SSE2
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[n - 1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i tail = _mm_loadu_si128((const __m128i *) (s + i + n - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(s + i + bit + 1, needle + 1, n - 2) == 0) {
+                return s + i + bit;
+            }
+            mask &= mask - 1;
         }
-        editorAppendRow(E.numrows, line, linelen);
     }
-    
-    free(line);
-    fclose(fp);
-    E.isDirty = 0;
+#endif
+    while (i + n <= len) {
+        const char *p = memchr(s + i, needle[0], len - n + 1 - i);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (memcmp(p + 1, needle + 1, n - 1) == 0) {
+            return p;
+        }
+        i = p - s + 1;
+    }
+    return NULL;
 }
 
-void saveFile() {
-    if (E.filename == NULL) {
-        E.filename = editorPrompt("Save As: %s (Press ESC to cancel)", NULL);
-        if (E.filename == NULL) {
-            editorSetStatusMessage("Save Aborted");
-            return;
+void searchIndexAppend(struct searchIndex *si, struct searchMatch *found, int n) {
+    if (si->count + n > si->cap) {
+        int cap = si->cap ? si->cap : 256;
+        while (cap < si->count + n) {
+            cap *= 2;
         }
-        editorSelectSyntaxHighlight();
+        si->matches = realloc(si->matches, sizeof(struct searchMatch) * cap);
+        si->cap = cap;
     }
+    memcpy(&si->matches[si->count], found, sizeof(struct searchMatch) * n);
+    si->count += n;
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
+// scan from si->scanned to the end of the buffer, publishing matches a leaf at a time. a leaf
+// with more than SEARCH_LEAF_MATCHES publishes them in batches as it goes
+void *searchWorker(void *arg) {
+    struct searchIndex *si = arg;
+    struct searchMatch found[SEARCH_LEAF_MATCHES];
+    int nfound = 0;
+    int from = si->scanned;
+    int start = 0;
+
+    for (int l = 0; l < si->nleaves; start += si->leaves[l]->count, l++) {
+        rowNode *leaf = si->leaves[l];
+        if (start + leaf->count <= from) {
+            continue;
+        }
+        int leafFirst = si->count; // only this thread changes count while it runs
+        for (int j = (from > start ? from - start : 0); j < leaf->count; j++) {
+            erow *row = &leaf->rows[j];
+            int col = 0, len = si->queryLen;
+            while (col <= row->size) {
+                if (si->re) {
+                    int end = regexFind(si->re, row->chars, row->size, col, &col);
+                    if (end == -1) {
+                        break;
+                    }
+                    len = end - col;
+                    if (len == 0) { // empty matches have nothing to show
+                        col++;
+                        continue;
+                    }
+                } else {
+                    const char *p = editorFindBytes(&row->chars[col], row->size - col, si->query, len);
+                    if (p == NULL) {
+                        break;
+                    }
+                    col = p - row->chars;
+                }
 
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.isDirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+                if (nfound == SEARCH_LEAF_MATCHES) {
+                    pthread_mutex_lock(&si->lock);
+                    searchIndexAppend(si, found, nfound);
+                    pthread_mutex_unlock(&si->lock);
+                    nfound = 0;
+                }
+                found[nfound].row = start + j;
+                found[nfound].col = col;
+                found[nfound].len = len;
+                nfound++;
+                // literal matches may overlap, pattern matches continue after the last one
+                col += si->re ? len : 1;
             }
         }
-        close(fd);
+
+        pthread_mutex_lock(&si->lock);
+        if (si->cancel) {
+            // take back the batches this leaf published, the index ends where scanned says.
+            // a scan carried on later starts from the leaf's first row again
+            si->count = leafFirst;
+            pthread_mutex_unlock(&si->lock);
+            return NULL;
+        }
+        searchIndexAppend(si, found, nfound);
+        nfound = 0;
+        si->scanned = start + leaf->count;
+        pthread_cond_broadcast(&si->progress);
+        pthread_mutex_unlock(&si->lock);
     }
-    
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
-}
 
-// Append Buffer -> pointer to buffer in memory
-struct abuf {
-    char *b;
-    int len;
-};
-// empty buffer
-#define ABUF_INIT {NULL, 0}
+    pthread_mutex_lock(&si->lock);
+    si->done = 1;
+    pthread_cond_broadcast(&si->progress);
+    pthread_mutex_unlock(&si->lock);
+    editorWake(WAKE_TASK);
+    return NULL;
+}
 
-void abAppend(struct abuf *ab, const char*s, int len) {
-    // realloc gives a block of memory to hold the new string. size of the current string + size of string we are appending
-    char *new = realloc(ab->b, ab->len + len);
+void searchIndexInit() {
+    memset(&E.search, 0, sizeof(E.search));
+    pthread_mutex_init(&E.search.lock, NULL);
+    pthread_cond_init(&E.search.progress, NULL);
+}
 
-    if (new == NULL) {
-        return;
+void searchIndexStop() {
+    struct searchIndex *si = &E.search;
+    if (si->running) {
+        pthread_mutex_lock(&si->lock);
+        si->cancel = 1;
+        pthread_mutex_unlock(&si->lock);
+        pthread_join(si->worker, NULL);
+        si->running = 0;
+        si->cancel = 0;
     }
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
 }
 
-void abFree(struct abuf *ab) {
-    free(ab->b);
+// forget the index, the buffer may have changed since it was built
+void searchIndexReset() {
+    struct searchIndex *si = &E.search;
+    searchIndexStop();
+    free(si->query);
+    free(si->leaves);
+    regexFree(si->re);
+    si->query = NULL;
+    si->queryLen = 0;
+    si->re = NULL;
+    si->leaves = NULL;
+    si->nleaves = 0;
+    si->count = 0;
+    si->scanned = 0;
+    si->done = 0;
 }
 
+// index a new query. when a literal query only extends the previous one, the matches already
+// found are filtered in place and the scan carries on from where it had got to. returns -1 for a
+// pattern that does not parse, which matches nothing
+int searchIndexStart(const char *query) {
+    struct searchIndex *si = &E.search;
+    int len = strlen(query);
+    searchIndexStop();
+
+    regexFree(si->re);
+    si->re = NULL;
+    if (si->regex && len > 0) {
+        si->re = regexCompile(query);
+    }
 
-// INPUT
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
-    size_t bufsize = 128;
-    char *buf = malloc(bufsize);
-    
-    size_t buflen = 0;
-    buf[0] = '\0';
-
-    while (1) {
-        editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
-
-        int c = editorReadKey();
-
-        // allow special keys in prompt
-        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-            if (buflen != 0) {
-                buf[--buflen] = '\0';
-            }
-        } else if (c == '\x1b') {
-            editorSetStatusMessage("");
-            if (callback) {
-                callback(buf, c);
-            }
-            free(buf);
-            return NULL;
-        } else if (c == '\r') {
-            if (buflen != 0) {
-                editorSetStatusMessage("");
-                if (callback) {
-                    callback(buf, c);
-                }
-                return buf;
-            }
-        } else if (!iscntrl(c) && c < 128) {
-            if (buflen == bufsize - 1) {
-                bufsize *= 2;
-                buf = realloc(buf, bufsize);
+    if (!si->regex && si->query && len > si->queryLen && strncmp(query, si->query, si->queryLen) == 0) {
+        int kept = 0;
+        for (int k = 0; k < si->count; k++) {
+            struct searchMatch m = si->matches[k];
+            erow *row = editorRowAt(m.row);
+            if (m.col + len <= row->size && memcmp(&row->chars[m.col], query, len) == 0) {
+                m.len = len;
+                si->matches[kept++] = m;
             }
-            buf[buflen++] = c;
-            buf[buflen] = '\0';
         }
-        if (callback) {
-            callback(buf, c);
+        si->count = kept;
+    } else {
+        si->count = 0;
+        si->scanned = 0;
+        si->done = 0;
+    }
+    free(si->query);
+    si->query = strdup(query);
+    si->queryLen = len;
+
+    if (si->leaves == NULL && B->rows) {
+        si->leaves = malloc(sizeof(rowNode *) * B->rows->leaves);
+        si->nleaves = 0;
+        rowTreeListLeaves(B->rows, si->leaves, &si->nleaves);
+    }
+    int invalid = si->regex && len > 0 && si->re == NULL;
+    if (si->scanned >= B->numrows || len == 0 || invalid) {
+        si->done = 1;
+        return invalid ? -1 : 0;
+    }
+    si->done = 0;
+    si->running = pthread_create(&si->worker, NULL, searchWorker, si) == 0;
+    if (!si->running) {
+        searchWorker(si);
+    }
+    return 0;
+}
+
+// first match at or after (row, col). caller holds the lock
+int searchIndexLowerBound(int row, int col) {
+    struct searchIndex *si = &E.search;
+    int lo = 0, hi = si->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct searchMatch *m = &si->matches[mid];
+        if (m->row < row || (m->row == row && m->col < col)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
 }
 
+// the match nearest (row, col) in direction dir, wrapping around the buffer: dir 0 accepts
+// (row, col) itself, 1 wants the one after, -1 the one before. waits for the worker only as far
+// as the answer needs. returns 0 when the buffer has no match at all
+int searchIndexSeek(int row, int col, int dir, struct searchMatch *out) {
+    struct searchIndex *si = &E.search;
+    int k;
 
-// convert renderx to a coordX
-int editorRowRenderXToCoordX(erow *row, int rx) {
-    int curr_rx = 0;
-    int coordX;
-    
-    for (coordX = 0; coordX < row->size; coordX++) {
-        if (row->chars[coordX] == '\t') {
-            curr_rx += (TAB_LENGTH_STOP - 1) - (curr_rx % TAB_LENGTH_STOP);
+    pthread_mutex_lock(&si->lock);
+    while (!si->done && si->scanned <= row) {
+        pthread_cond_wait(&si->progress, &si->lock);
+    }
+    if (dir >= 0) {
+        k = searchIndexLowerBound(row, col + dir);
+        while (k == si->count && !si->done) {
+            pthread_cond_wait(&si->progress, &si->lock);
         }
-        curr_rx++;
-
-        if (curr_rx > rx) {
-            return coordX;
+        if (k == si->count) {
+            k = 0;
+        }
+    } else {
+        k = searchIndexLowerBound(row, col) - 1;
+        if (k < 0) {
+            while (!si->done) {
+                pthread_cond_wait(&si->progress, &si->lock);
+            }
+            k = si->count - 1;
         }
     }
-    return coordX;
+    int found = k >= 0 && k < si->count;
+    if (found) {
+        *out = si->matches[k];
+    }
+    pthread_mutex_unlock(&si->lock);
+    return found;
 }
 
+char searchPrompt[96] = SEARCH_PROMPT; // re-read by editorPrompt every keystroke
+
 void searchCB(char *term, int key) {
-    static int prev_match = -1;
-    static int dir = 1;
+    static struct searchMatch current = { 0, 0, 0 }; // where the last match was, or the top of the file
+    int dir;
 
     static int saved_highlight_line;
     static char *saved_highlight = NULL;
 
     if (saved_highlight) {
-        memcpy(E.row[saved_highlight_line].highlight, saved_highlight, E.row[saved_highlight_line].renderSize);
+        // the slot may have been recycled since, in which case it gets rebuilt clean anyway
+        // and a long row's window may have moved, it is styled again when next drawn
+        struct rowRender *rr = editorRowCached(editorRowAt(saved_highlight_line));
+        if (rr && rr->longRow) {
+            rr->winTo = -1;
+        } else if (rr) {
+            memcpy(rr->highlight, saved_highlight, rr->renderSize);
+        }
         free(saved_highlight);
         saved_highlight = NULL;
     }
 
+    if (key == TASK_DONE) {
+        // the index is complete: show the match count after the query
+        pthread_mutex_lock(&E.search.lock);
+        int count = E.search.count, done = E.search.done && E.search.query;
+        pthread_mutex_unlock(&E.search.lock);
+        if (done && term[0] != '\0') {
+            const char *base = E.search.regex ? SEARCH_PROMPT_REGEX : SEARCH_PROMPT;
+            const char *rest = strstr(base, "%s") + 2;
+            snprintf(searchPrompt, sizeof(searchPrompt), "%.*s [%d match%s]%s", (int) (rest - base), base,
+                    count, count == 1 ? "" : "es", rest);
+        }
+        return;
+    }
+
     if (key == '\r' || key == '\x1b') {
-        prev_match = -1;
-        dir = 1;
+        current.row = current.col = 0;
+        searchIndexReset();
         return;
     } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
         dir = 1;
     } else if (key == ARROW_LEFT || key == ARROW_UP) {
         dir = -1;
     } else {
-        prev_match = -1;
-        dir = 1;
+        if (key == CTRL_KEY('r')) {
+            E.search.regex = !E.search.regex;
+            free(E.search.query); // never extend a query across modes
+            E.search.query = NULL;
+        }
+        // the query changed: stay on the current match if it still matches
+        int invalid = searchIndexStart(term) == -1;
+        strcpy(searchPrompt, invalid ? SEARCH_PROMPT_INVALID : E.search.regex ? SEARCH_PROMPT_REGEX : SEARCH_PROMPT);
+        dir = 0;
     }
 
-    if (prev_match == -1) {
-        dir = 1;
+    struct searchMatch match;
+    if (term[0] == '\0' || !searchIndexSeek(current.row, current.col, dir, &match)) {
+        return;
     }
-
-    int current = prev_match;
-
-    int i;
-    for (i = 0; i < E.numrows; i++) {
-        current += dir;
-        if (current == -1) {
-            current = E.numrows - 1;
-        } else if (current == E.numrows) {
-            current = 0;
-        }
-
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, term);
-        if (match) {
-            prev_match = current;
-            E.coordY = current;
-            E.coordX = editorRowRenderXToCoordX(row, match - row->render);
-            E.rowOffset = E.numrows;
-
-            saved_highlight_line = current;
-            saved_highlight = malloc(row->renderSize);
-            memcpy(saved_highlight, row->highlight, row->renderSize);
-
-            memset(&row->highlight[match - row->render], HL_MATCH, strlen(term));
-            break;
-        }
+    current = match;
+
+    erow *row = editorRowAt(match.row);
+    B->coordY = match.row;
+    B->coordX = match.col;
+    B->rowOffset = B->numrows;
+    editorScroll(); // a long row renders only the columns on screen, bring the match there first
+
+    struct rowRender *rr = editorRowRender(match.row);
+    saved_highlight_line = match.row;
+    saved_highlight = malloc(rr->renderSize);
+    memcpy(saved_highlight, rr->highlight, rr->renderSize);
+
+    struct columnMark from = editorRowMarkAt(row, rr, match.col);
+    struct columnMark to = editorRowMarkAt(row, rr, match.col + match.len);
+    if (to.chars < match.col + match.len) {
+        editorRowStep(row, &to); // the match ends inside a glyph, take all of it
     }
+    if (to.render > rr->renderSize) {
+        to.render = rr->renderSize; // runs off the end of a long row's window
+    }
+    memset(&rr->highlight[from.render], HL_MATCH, to.render - from.render);
 }
 
 void search() {
-    int stored_coordX = E.coordX;
-    int stored_coordY = E.coordY;
-    int stored_colOffset = E.colOffset;
-    int stored_rowOffset = E.rowOffset;
+    int stored_coordX = B->coordX;
+    int stored_coordY = B->coordY;
+    int stored_colOffset = B->colOffset;
+    int stored_rowOffset = B->rowOffset;
 
-    char *term = editorPrompt("Search: %s (Press ESC/Arrows/Enter)", searchCB);
+    strcpy(searchPrompt, E.search.regex ? SEARCH_PROMPT_REGEX : SEARCH_PROMPT);
+    char *term = editorPrompt(searchPrompt, searchCB, 0);
 
     if (term) {
         free(term);
     } else {
-        E.coordX = stored_coordX;
-        E.coordY = stored_coordY;
-        E.colOffset = stored_colOffset;
-        E.rowOffset = stored_rowOffset;
+        B->coordX = stored_coordX;
+        B->coordY = stored_coordY;
+        B->colOffset = stored_colOffset;
+        B->rowOffset = stored_rowOffset;
+    }
+}
+
+// REPLACE
+// replace-all finds every match in one pass over the rows, collecting each row's rewritten span,
+// then rewrites each row with a match once, so it is restyled once. the whole replace is one
+// UNDO_REPLACE op holding each row's old and new span, a few bytes over the text itself, so a
+// million matches still fit under the cap. one too big for it drops the history instead
+
+// rewrite every match in chars: append to ab the span from the start of the first match to the
+// end of the last, each match in it replaced by with, and set *from and *to to the span of chars
+// it replaces. matches are of the literal find, or of re when it is not NULL. as in sed, an
+// empty match right where the previous match ended does not count. returns how many matched
+int editorReplaceSpan(const char *chars, int size, const char *find, int findLen, struct regex *re,
+        const char *with, int withLen, struct abuf *ab, int *from, int *to) {
+    int col = 0, done = 0, n = 0, lastEnd = -1;
+    while (col <= size) {
+        int start, end;
+        if (re) {
+            end = regexFind(re, chars, size, col, &start);
+            if (end == -1) {
+                break;
+            }
+        } else {
+            const char *p = editorFindBytes(&chars[col], size - col, find, findLen);
+            if (p == NULL) {
+                break;
+            }
+            start = p - chars;
+            end = start + findLen;
+        }
+        if (end != start || start != lastEnd) {
+            if (n == 0) {
+                *from = done = start;
+            }
+            abAppend(ab, &chars[done], start - done);
+            abAppend(ab, with, withLen);
+            done = end;
+            lastEnd = end;
+            n++;
+        }
+        // an empty match takes the byte after it along, so the next search moves past it
+        if (end == start) {
+            if (end < size) {
+                abAppend(ab, &chars[end], 1);
+            }
+            done = end + 1;
+        }
+        col = done;
+    }
+    *to = done < size ? done : size;
+    return n;
+}
+
+// a row's part in a replace-all: chars [from, to) become len bytes at off in the new text
+struct replaceRow {
+    int row;
+    int from, to;
+    int off, len;
+};
+
+// replace every match of find (a pattern when re is given) with with. returns the number of
+// matches and sets *rows to the rows they were on
+int editorReplaceAll(const char *find, struct regex *re, const char *with, int *rows) {
+    int findLen = strlen(find), withLen = strlen(with);
+    struct abuf text = ABUF_INIT;
+    struct replaceRow *spans = NULL;
+    int nspans = 0, cap = 0, count = 0;
+    size_t oldBytes = 0;
+
+    for (int r = 0; r < B->numrows; r++) {
+        erow *row = editorRowAt(r);
+        int off = text.len, from, to;
+        int n = editorReplaceSpan(row->chars, row->size, find, findLen, re, with, withLen, &text, &from, &to);
+        if (n == 0) {
+            continue;
+        }
+        if (nspans == cap) {
+            cap = cap ? cap * 2 : 256;
+            spans = realloc(spans, sizeof(struct replaceRow) * cap);
+        }
+        spans[nspans].row = r;
+        spans[nspans].from = from;
+        spans[nspans].to = to;
+        spans[nspans].off = off;
+        spans[nspans].len = text.len - off;
+        nspans++;
+        count += n;
+        oldBytes += to - from;
+    }
+    *rows = nspans;
+    if (nspans == 0) {
+        abFree(&text);
+        return 0;
+    }
+
+    const char *newText = text.b ? text.b : ""; // every match replaced by nothing
+    size_t undoBytes = sizeof(struct undoReplace) * nspans + oldBytes + text.len;
+    struct undoOp *op = undoBytes <= INT_MAX ? editorUndoPush(UNDO_REPLACE, 0, 1, nspans, 0, undoBytes) : NULL;
+    if (op == NULL) {
+        editorUndoClear();
+    }
+    struct undoReplace *undoRows = op ? (struct undoReplace *) (op + 1) : NULL;
+    char *oldText = op ? (char *) &undoRows[nspans] : NULL;
+    for (int j = 0; j < nspans; j++) {
+        struct replaceRow *sp = &spans[j];
+        erow *row = editorRowAt(sp->row);
+        int oldLen = sp->to - sp->from;
+        if (op) {
+            undoRows[j] = (struct undoReplace) { sp->row, sp->from, oldLen, sp->len };
+            memcpy(oldText, &row->chars[sp->from], oldLen);
+            oldText += oldLen;
+        }
+        journalAppend(UNDO_DELETE, sp->row, sp->from, NULL, oldLen);
+        journalAppend(UNDO_INSERT, sp->row, sp->from, &newText[sp->off], sp->len);
+        editorRowReplace(sp->row, sp->from, oldLen, &newText[sp->off], sp->len);
+    }
+    if (op) {
+        memcpy(oldText, newText, text.len); // the new spans, back to back in row order
+    }
+    B->undoBroken = 1;
+
+    if (B->coordY < B->numrows && B->coordX > editorRowAt(B->coordY)->size) {
+        B->coordX = editorRowAt(B->coordY)->size;
+    }
+    free(spans);
+    abFree(&text);
+    return op ? count : -count;
+}
+
+// ask for what to replace and what with, then replace it all. the query is a pattern when the
+// search prompt was last left in regex mode
+void replace() {
+    int regex = E.search.regex;
+    char *find = editorPrompt(regex ? "Replace regex: %s (ESC to cancel)" : "Replace: %s (ESC to cancel)", NULL, 0);
+    if (find == NULL) {
+        editorSetStatusMessage("Replace aborted");
+        return;
+    }
+    struct regex *re = NULL;
+    if (regex && (re = regexCompile(find)) == NULL) {
+        editorSetStatusMessage("Invalid pattern");
+        free(find);
+        return;
+    }
+    char *with = editorPrompt("With: %s (ESC to cancel)", NULL, 1);
+    if (with == NULL) {
+        editorSetStatusMessage("Replace aborted");
+    } else {
+        int rows;
+        int count = editorReplaceAll(find, re, with, &rows);
+        if (count < 0) {
+            editorSetStatusMessage("Replaced %d on %d rows, too many to undo", -count, rows);
+        } else {
+            editorSetStatusMessage("Replaced %d on %d rows", count, rows);
+        }
     }
+    regexFree(re);
+    free(find);
+    free(with);
 }
 
 void editorMoveCursor(int key) {
-    erow *row = (E.coordY >= E.numrows) ? NULL : &E.row[E.coordY];
+    erow *row = (B->coordY >= B->numrows) ? NULL : editorRowAt(B->coordY);
+    // moving up and down keeps to the screen column, whatever the glyphs on the way
+    int column = (row && (key == ARROW_UP || key == ARROW_DOWN)) ? editorRowCoordXtoRenderX(B->coordY, B->coordX) : -1;
     switch (key) {
         case ARROW_LEFT:
-            if (E.coordX != 0) {
-                E.coordX--;
-            } else if (E.coordY > 0) { // if <- at start of line, move up
-                E.coordY--;
-                E.coordX = E.row[E.coordY].size;
+            if (B->coordX != 0) {
+                B->coordX = editorRowPrevGlyph(B->coordY, B->coordX);
+            } else if (B->coordY > 0) { // if <- at start of line, move up
+                B->coordY--;
+                B->coordX = editorRowAt(B->coordY)->size;
             }
             break;
         case ARROW_RIGHT:
-            if (row && E.coordX < row->size) {
-                E.coordX++;
-            } else if (row && E.coordX == row->size) { // if -> at end of line, move down
-                E.coordY++;
-                E.coordX = 0;
+            if (row && B->coordX < row->size) {
+                B->coordX = editorRowNextGlyph(B->coordY, B->coordX);
+            } else if (row && B->coordX == row->size) { // if -> at end of line, move down
+                B->coordY++;
+                B->coordX = 0;
             }
             break;
         case ARROW_UP:
-            if (E.coordY != 0) {
-                E.coordY--;
+            if (B->coordY != 0) {
+                B->coordY--;
             }
             break;
         case ARROW_DOWN:
             // allow scrolling past bottom of screen, but not past bottom of file
-            if (E.coordY < E.numrows) {
-                E.coordY++;
+            if (B->coordY < B->numrows) {
+                B->coordY++;
             }
             break;
     }
 
-    row = (E.coordY >= E.numrows) ? NULL : &E.row[E.coordY];
+    row = (B->coordY >= B->numrows) ? NULL : editorRowAt(B->coordY);
+    if (row && column >= 0) {
+        B->coordX = editorRowRenderXToCoordX(B->coordY, column);
+    }
     int rowLength = row ? row->size : 0;
-    if (E.coordX > rowLength) {
-        E.coordX = rowLength;
+    if (B->coordX > rowLength) {
+        B->coordX = rowLength;
     }
 }
 
-void editorProcessKeypress() {
+void editorHandleKey(int c) {
     static int quit_times = REMAINING_QUIT_ATTEMPTS;
-    int c = editorReadKey();
+    static int close_confirm = 0;
+    unsigned long serial = B->undoSerial;
 
     switch(c) {
         case '\r':
             editorInsertNewline();
             break;
         case CTRL_KEY('q'):
-            if (E.isDirty && quit_times > 0) {
+            if (editorBuffersDirty() && quit_times > 0) {
                 editorSetStatusMessage("WARNING!!! FILE HAS UNSAVED CHANGES. QUIT %d more times to exit editor.", quit_times);
                 quit_times--;
                 return;
             }
+            for (int j = 0; j < E.nbuffers; j++) {
+                editorBufferSwitch(j);
+                journalStop(1);
+            }
             // clear screen then exist when ctrl-q
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
@@ -980,17 +6423,41 @@ void editorProcessKeypress() {
         case CTRL_KEY('s'):
             saveFile();
             break;
+        case CTRL_KEY('o'):
+            editorBufferOpenPrompt();
+            break;
+        case CTRL_KEY('n'):
+        case CTRL_KEY('p'):
+            editorBufferNext(c == CTRL_KEY('n') ? 1 : -1);
+            break;
+        case CTRL_KEY('w'):
+            if (B->isDirty && !close_confirm) {
+                editorSetStatusMessage("WARNING!!! BUFFER HAS UNSAVED CHANGES. Ctrl-W again to close it.");
+                close_confirm = 1;
+                return;
+            }
+            editorBufferClose();
+            break;
         case HOME_KEY:
-            E.coordX = 0;
+            B->coordX = 0;
             break;
         case END_KEY:
-            if (E.coordY < E.numrows) {
-                E.coordX = E.row[E.coordY].size;
+            if (B->coordY < B->numrows) {
+                B->coordX = editorRowAt(B->coordY)->size;
             }
             break;
         case CTRL_KEY('f'):
             search();
             break;
+        case CTRL_KEY('r'):
+            replace();
+            break;
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
         case BACKSPACE:
         case CTRL_KEY('h'):
         case DEL_KEY:
@@ -1002,11 +6469,11 @@ void editorProcessKeypress() {
         case PAGE_UP:
         case PAGE_DOWN: // scroll up/down an entire page
             if (c == PAGE_UP) {
-                E.coordY = E.rowOffset;
+                B->coordY = B->rowOffset;
             } else if (c == PAGE_DOWN) {
-                E.coordY = E.rowOffset + E.screenrows - 1;
-                if (E.coordY > E.numrows) {
-                    E.coordY = E.numrows;
+                B->coordY = B->rowOffset + E.screenrows - 1;
+                if (B->coordY > B->numrows) {
+                    B->coordY = B->numrows;
                 }
             }
             int times = E.screenrows;
@@ -1021,60 +6488,162 @@ void editorProcessKeypress() {
         case ARROW_RIGHT:
             editorMoveCursor(c);
             break;
+        case CTRL_KEY('t'):
+            E.perf.overlay = !E.perf.overlay;
+            perfTimingUpdate();
+            break;
         case CTRL_KEY('l'):
         case '\x1b':
             break;
+        case PASTE_BEGIN:
+            editorPaste();
+            break;
         // add character not mapped above
         default:
-            editorInsertChar(c);
+            if (editorIsTyped(c)) {
+                // characters typed ahead go in together, one insert and one restyle
+                char run[TYPED_BATCH];
+                int len = 0;
+                run[len++] = c;
+                while (len < TYPED_BATCH && editorInputCount() > 0 && editorIsTyped(editorInputAt(0))) {
+                    run[len++] = editorInputAt(0);
+                    E.loop.head++;
+                }
+                editorInsertChars(run, len);
+            } else {
+                editorInsertChar(c);
+            }
             break;
     }
+    // a key that edits nothing ends the run of typing or deleting
+    if (B->undoSerial == serial) {
+        B->undoBroken = 1;
+    }
     quit_times = REMAINING_QUIT_ATTEMPTS;
+    close_confirm = 0;
+}
+
+void editorProcessKeypress() {
+    int c = editorReadKey();
+    struct perfSpan span = perfBegin();
+    editorHandleKey(c);
+    perfEnd("key", &span, 0);
 }
 
 // OUTPUT
 
-int editorRowCoordXtoRenderX(erow *row, int coordX) {
-    int renderX = 0;
-    int j;
-    for (j = 0; j < coordX; j++) {
-        if (row->chars[j] == '\t') {
-            renderX += (TAB_LENGTH_STOP - 1) - (renderX % TAB_LENGTH_STOP);
-        }
-        renderX++;
-    }
-    return renderX;
+// screen column of chars offset coordX, through the row's column map
+int editorRowCoordXtoRenderX(int filerow, int coordX) {
+    struct rowRender *rr = editorRowMapped(filerow);
+    return editorRowMarkAt(editorRowAt(filerow), rr, coordX).column;
+}
+
+// chars offset of the glyph at screen column renderX
+int editorRowRenderXToCoordX(int filerow, int renderX) {
+    struct rowRender *rr = editorRowMapped(filerow);
+    return editorRowMarkAtColumn(editorRowAt(filerow), rr, renderX).chars;
 }
 
 void editorScroll() {
-    E.renderX = 0;
+    B->renderX = 0;
 
-    if (E.coordY < E.numrows) {
-        E.renderX = editorRowCoordXtoRenderX(&E.row[E.coordY], E.coordX);
+    if (B->coordY < B->numrows) {
+        B->renderX = editorRowCoordXtoRenderX(B->coordY, B->coordX);
     }
     // check if cursor is above visible window. If so, move to where cursor is
-    if (E.coordY < E.rowOffset) {
-        E.rowOffset = E.coordY;
+    if (B->coordY < B->rowOffset) {
+        B->rowOffset = B->coordY;
     }
     // check if cursor is below visible window. If so, move 
-    if (E.coordY >= E.rowOffset + E.screenrows) {
-        E.rowOffset = E.coordY - E.screenrows + 1;
+    if (B->coordY >= B->rowOffset + E.screenrows) {
+        B->rowOffset = B->coordY - E.screenrows + 1;
+    }
+    if (B->renderX < B->colOffset) {
+        B->colOffset = B->renderX;
+    }
+    if (B->renderX >= B->colOffset + E.screencols) {
+        B->colOffset = B->renderX - E.screencols + 1;
+    }
+}
+
+// write one glyph of len bytes, width columns wide, into the frame being drawn. control
+// characters and bytes that are not UTF-8 show as inverse ^X or ?. a wide glyph cut by either
+// edge of the screen shows as spaces
+void editorFrameGlyph(int y, int x, const char *s, int len, int width, unsigned char attr) {
+    if (x + width <= 0 || x >= E.screencols) {
+        return;
     }
-    if (E.renderX < E.colOffset) {
-        E.colOffset = E.renderX;
+    int cell = y * E.screencols + x;
+    if (x < 0 || x + width > E.screencols) {
+        for (int j = x < 0 ? 0 : x; j < x + width && j < E.screencols; j++) {
+            E.frame.text[y * E.screencols + j] = ' ';
+            E.frame.attr[y * E.screencols + j] = attr;
+        }
+        return;
+    }
+
+    unsigned char c = s[0];
+    unsigned int cp;
+    if (utf8Decode(s, len, &cp) == 0 || cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) {
+        E.frame.text[cell] = c <= 26 ? '@' + c : '?';
+        E.frame.attr[cell] = CELL_INVERSE;
+        return;
+    }
+    if (len == 1) {
+        E.frame.text[cell] = c;
+        E.frame.attr[cell] = attr;
+        return;
+    }
+
+    char *glyph = &E.frame.glyphs[cell * FRAME_GLYPH_BYTES];
+    int n = 0;
+    if (utf8CharWidth(cp) == 0) {
+        glyph[1 + n++] = ' '; // something for the mark to go on
+    }
+    // whole characters only, as many as fit
+    for (int at = 0, clen; at < len && n + (clen = utf8Decode(&s[at], len - at, &cp)) < FRAME_GLYPH_BYTES; at += clen) {
+        memcpy(&glyph[1 + n], &s[at], clen);
+        n += clen;
     }
-    if (E.renderX >= E.colOffset + E.screencols) {
-        E.colOffset = E.renderX - E.screencols + 1;
+    glyph[0] = n;
+    E.frame.text[cell] = CELL_GLYPH;
+    E.frame.attr[cell] = attr;
+    if (width == 2) {
+        E.frame.text[cell + 1] = CELL_WIDE_TAIL;
+        E.frame.attr[cell + 1] = attr;
+    }
+}
+
+// write text into the frame being drawn, clipped to the screen
+void editorFramePut(int y, int x, const char *s, int len, unsigned char attr) {
+    for (int j = 0; j < len && x < E.screencols; ) {
+        // a run of printable ASCII is copied in one go
+        int run = j;
+        while (run < len && run - j < E.screencols - x && s[run] >= 32 && s[run] < 127 &&
+                (run + 1 == len || (unsigned char) s[run + 1] < 0x80)) {
+            run++;
+        }
+        if (run > j) {
+            memcpy(&E.frame.text[y * E.screencols + x], &s[j], run - j);
+            memset(&E.frame.attr[y * E.screencols + x], attr, run - j);
+            x += run - j;
+            j = run;
+            continue;
+        }
+        int width, end = utf8GlyphEnd(s, len, j, &width);
+        editorFrameGlyph(y, x, &s[j], end - j, width, attr);
+        x += width;
+        j = end;
     }
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows() {
     int y;
     // dynamically set screenrows at start
     for (y = 0; y < E.screenrows; y++) {
-        int filerow = y + E.rowOffset;
-        if (filerow >= E.numrows) {
-            if (E.numrows == 0 && y == E.screenrows / 3) {
+        int filerow = y + B->rowOffset;
+        if (filerow >= B->numrows) {
+            if (B->numrows == 0 && y == E.screenrows / 3) {
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome), "Sanky Editor -- Version %s", EDITOR_VERSION);
 
@@ -1083,176 +6652,819 @@ void editorDrawRows(struct abuf *ab) {
                 }
                 // centers a string
                 int padding = (E.screencols - welcomelen) / 2;
+                int x = 0;
 
                 if (padding) {
-                    abAppend(ab, "~", 1);
+                    editorFramePut(y, x++, "~", 1, 0);
                     padding--;
                 }
 
-                while (padding--) {
-                    abAppend(ab, " ", 1);
-                }
-                abAppend(ab, welcome, welcomelen);
+                x += padding;
+                editorFramePut(y, x, welcome, welcomelen, 0);
             } else {
-                abAppend(ab, "~", 1);
+                editorFramePut(y, 0, "~", 1, 0);
             }
         } else {
-            int len = E.row[filerow].renderSize - E.colOffset;
-            // len = 0 prevents colOffset from making len a negative number/past the end of line
-            if (len < 0) {
-                len = 0;
-            }
-            if (len > E.screencols) {
-                len = E.screencols;
-            }
-
-            char *c = &E.row[filerow].render[E.colOffset];
-            unsigned char *highlight = &E.row[filerow].highlight[E.colOffset];
-            int current_color = -1;
-
-            int j;
-            for (j = 0; j < len; j++) {
-                if (iscntrl(c[j])) { // check if special character
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?'; // if special character, make it printable by adding @
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if (current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                } else if (highlight[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
+            struct rowRender *rr = editorRowRender(filerow);
+            erow *row = editorRowAt(filerow);
+
+            // start from the glyph under the left edge, it may be a wide one cut in half
+            struct columnMark m = editorRowMarkAtColumn(row, rr, B->colOffset);
+            int x = m.column - B->colOffset;
+            char *text = &E.frame.text[y * E.screencols];
+            unsigned char *attr = &E.frame.attr[y * E.screencols];
+            while (x < E.screencols) {
+                // printable ASCII, one byte to a column, is written straight into the frame
+                unsigned char c = m.chars < row->size ? row->chars[m.chars] : 0;
+                if (c >= 32 && c < 127 && x >= 0 && (m.chars + 1 == row->size || (unsigned char) row->chars[m.chars + 1] < 0x80)) {
+                    unsigned char hl = rr->highlight[m.render];
+                    text[x] = c;
+                    attr[x] = (hl == HL_NORMAL) ? 0 : editorSyntaxColoring(hl);
+                    m.chars++;
+                    m.render++;
+                    m.column++;
+                    x++;
+                    continue;
+                }
+                struct columnMark next = m;
+                if (!editorRowStep(row, &next)) {
+                    break;
+                }
+                unsigned char hl = rr->highlight[m.render];
+                unsigned char color = (hl == HL_NORMAL) ? 0 : editorSyntaxColoring(hl);
+                if (c == '\t') {
+                    for (; x < next.column - B->colOffset && x < E.screencols; x++) {
+                        if (x >= 0) {
+                            text[x] = ' ';
+                            attr[x] = color;
+                        }
                     }
-
-                    abAppend(ab, &c[j], 1);
                 } else {
-                    int color = editorSyntaxColoring(highlight[j]);
-
-                    if (color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-
-                    abAppend(ab, &c[j], 1);
+                    editorFrameGlyph(y, x, &row->chars[m.chars], next.chars - m.chars, next.column - m.column, color);
                 }
+                x = next.column - B->colOffset;
+                m = next;
             }
-
-            abAppend(ab, "\x1b[39m", 5);
         }
-       
-        // clear line -> esc[K
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
     }
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-    // m -> makes text printed after it to be printed with attributes like bold (1), underscore (4), blink (5) and inverted colors(7)
-    abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar() {
+    char status[80], rstatus[128];
+    int y = E.screenrows;
 
-    char status[80], rstatus[80];
-
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numrows, E.isDirty ? "(modified)" : "");
+    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s%s", B->filename ? B->filename : "[No Name]", B->numrows, B->isDirty ? "(modified) " : "", B->follow.on ? "(following)" : "");
     
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype : "no FT", E.coordY + 1, E.numrows);
+    int rlen = 0;
+    if (E.perf.overlay) {
+        // the key painted last, the frame written last
+        long long last = E.perf.nlatency ? E.perf.latency[(E.perf.nlatency - 1) % PERF_LATENCIES] : 0;
+        rlen = snprintf(rstatus, sizeof(rstatus), "key %.2fms p99 %.2fms %zuB %llurows | ", last / 1e6,
+                perfLatencyP99() / 1e6, E.frameBytes, E.perf.lastRows);
+    }
+    rlen += snprintf(&rstatus[rlen], sizeof(rstatus) - rlen, "%s | %d/%d", B->syntax ? B->syntax->filetype : "no FT", B->coordY + 1, B->numrows);
+    if (E.nbuffers > 1) {
+        rlen += snprintf(&rstatus[rlen], sizeof(rstatus) - rlen, " [%d/%d]", E.current + 1, E.nbuffers);
+    }
     
     if (len > E.screencols) {
         len = E.screencols;
     }
 
-    abAppend(ab, status, len);
-
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+    // the whole bar is drawn in inverted colors
+    memset(&E.frame.attr[y * E.screencols], CELL_INVERSE, E.screencols);
+    editorFramePut(y, 0, status, len, CELL_INVERSE);
+    if (len + rlen <= E.screencols) {
+        editorFramePut(y, E.screencols - rlen, rstatus, rlen, CELL_INVERSE);
     }
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar() {
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screencols) {
         msglen = E.screencols;
     }
 
-    if (msglen && time(NULL) - E.statusmsg_time < 5) {
-        abAppend(ab, E.statusmsg, msglen);
+    if (msglen && time(NULL) - E.statusmsg_time < STATUS_MSG_SECONDS) {
+        editorFramePut(E.screenrows + 1, 0, E.statusmsg, msglen, 0);
+    }
+}
+
+void editorFrameInit() {
+    size_t cells = (size_t) (E.screenrows + 2) * E.screencols;
+    free(E.frame.text);
+    free(E.frame.attr);
+    free(E.frame.glyphs);
+    free(E.prevFrame.text);
+    free(E.prevFrame.attr);
+    free(E.prevFrame.glyphs);
+    E.frame.text = malloc(cells);
+    E.frame.attr = malloc(cells);
+    E.frame.glyphs = malloc(cells * FRAME_GLYPH_BYTES);
+    E.prevFrame.text = malloc(cells);
+    E.prevFrame.attr = malloc(cells);
+    E.prevFrame.glyphs = malloc(cells * FRAME_GLYPH_BYTES);
+    E.frameValid = 0;
+}
+
+// blank rows [y, y + rows) of a frame
+void editorFrameClear(struct screenFrame *frame, int y, int rows) {
+    memset(&frame->text[y * E.screencols], ' ', rows * E.screencols);
+    memset(&frame->attr[y * E.screencols], 0, rows * E.screencols);
+}
+
+void editorEmitAttr(struct abuf *ab, unsigned char attr) {
+    char buf[16];
+    int color = attr & ~CELL_INVERSE;
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dm", (attr & CELL_INVERSE) ? 7 : 27, color ? color : 39);
+    abAppend(ab, buf, len);
+}
+
+void editorEmitMove(struct abuf *ab, int y, int x) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    abAppend(ab, buf, len);
+}
+
+// the glyphs of rows [from, from + rows) to rows starting at to, the rows' text already moved.
+// only cells holding a glyph are copied, most rows have none
+void editorFrameMoveGlyphs(struct screenFrame *frame, int to, int from, int rows) {
+    int cols = E.screencols;
+    for (int r = 0; r < rows; r++) {
+        int y = to < from ? r : rows - 1 - r; // front to back or back to front, as memmove would
+        char *text = &frame->text[(to + y) * cols];
+        char *cell = text;
+        while ((cell = memchr(cell, CELL_GLYPH, cols - (cell - text))) != NULL) {
+            int x = cell - text;
+            memcpy(&frame->glyphs[((to + y) * cols + x) * FRAME_GLYPH_BYTES],
+                    &frame->glyphs[((from + y) * cols + x) * FRAME_GLYPH_BYTES], FRAME_GLYPH_BYTES);
+            cell++;
+        }
+    }
+}
+
+// shift what the terminal shows by scrolling the text area instead of repainting it
+void editorEmitScroll(struct abuf *ab) {
+    int delta = B->rowOffset - E.frameRowOffset;
+    if (delta == 0 || delta >= E.screenrows || -delta >= E.screenrows) {
+        return;
+    }
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r", E.screenrows, delta > 0 ? delta : -delta, delta > 0 ? 'S' : 'T');
+    abAppend(ab, buf, len);
+
+    int cols = E.screencols;
+    int keep = E.screenrows - (delta > 0 ? delta : -delta);
+    if (delta > 0) {
+        memmove(E.prevFrame.text, &E.prevFrame.text[delta * cols], keep * cols);
+        memmove(E.prevFrame.attr, &E.prevFrame.attr[delta * cols], keep * cols);
+        editorFrameMoveGlyphs(&E.prevFrame, 0, delta, keep);
+        editorFrameClear(&E.prevFrame, keep, delta);
+    } else {
+        memmove(&E.prevFrame.text[-delta * cols], E.prevFrame.text, keep * cols);
+        memmove(&E.prevFrame.attr[-delta * cols], E.prevFrame.attr, keep * cols);
+        editorFrameMoveGlyphs(&E.prevFrame, -delta, 0, keep);
+        editorFrameClear(&E.prevFrame, 0, -delta);
+    }
+}
+
+// emit one row's differences against the previous frame. runs of changed cells are written in
+// place, short unchanged gaps between them are rewritten rather than skipped, and a blank tail
+// is cleared with a single erase. each same-colour run goes out as one piece
+void editorEmitRowDamage(struct abuf *ab, int y, unsigned char *attr) {
+    int cols = E.screencols;
+    char *text = &E.frame.text[y * cols];
+    unsigned char *color = &E.frame.attr[y * cols];
+    char *oldText = &E.prevFrame.text[y * cols];
+    unsigned char *oldColor = &E.prevFrame.attr[y * cols];
+    char *glyphs = &E.frame.glyphs[y * cols * FRAME_GLYPH_BYTES];
+    char *oldGlyphs = &E.prevFrame.glyphs[y * cols * FRAME_GLYPH_BYTES];
+
+#define GLYPH(g, x) (&(g)[(x) * FRAME_GLYPH_BYTES])
+#define CELL_CHANGED(x) (text[x] != oldText[x] || color[x] != oldColor[x] || \
+        (text[x] == CELL_GLYPH && memcmp(GLYPH(glyphs, x), GLYPH(oldGlyphs, x), GLYPH(glyphs, x)[0] + 1)))
+
+    int tail = cols; // start of the blank tail of the new row
+    while (tail > 0 && text[tail - 1] == ' ' && color[tail - 1] == 0) {
+        tail--;
+    }
+
+    int x = 0;
+    while (x < tail) {
+        if (!CELL_CHANGED(x)) {
+            x++;
+            continue;
+        }
+
+        if (text[x] == CELL_WIDE_TAIL && x > 0) {
+            x--; // the terminal draws a wide glyph from its left half
+        }
+        int spanEnd = x + 1;
+        int probe = spanEnd;
+        while (probe < tail && probe - spanEnd <= DAMAGE_GAP) {
+            if (CELL_CHANGED(probe)) {
+                spanEnd = probe + 1;
+            }
+            probe++;
+        }
+
+        editorEmitMove(ab, y, x);
+        while (x < spanEnd) {
+            int run = x + 1;
+            while (run < spanEnd && color[run] == color[x]) {
+                run++;
+            }
+            if (color[x] != *attr) {
+                *attr = color[x];
+                editorEmitAttr(ab, *attr);
+            }
+            while (x < run) {
+                int plain = x;
+                while (plain < run && text[plain] != CELL_GLYPH && text[plain] != CELL_WIDE_TAIL) {
+                    plain++;
+                }
+                if (plain - x >= ABUF_REF_MIN) {
+                    abAppendRef(ab, &text[x], plain - x);
+                } else {
+                    abAppend(ab, &text[x], plain - x);
+                }
+                x = plain;
+                // glyphs go out as their bytes, the right half of a wide one as nothing
+                if (x < run) {
+                    if (text[x] == CELL_GLYPH) {
+                        abAppend(ab, GLYPH(glyphs, x) + 1, GLYPH(glyphs, x)[0]);
+                    }
+                    x++;
+                }
+            }
+        }
+    }
+
+    for (x = tail; x < cols; x++) {
+        if (CELL_CHANGED(x)) {
+            editorEmitMove(ab, y, tail);
+            if (*attr != 0) {
+                *attr = 0;
+                abAppend(ab, "\x1b[m", 3);
+            }
+            abAppend(ab, "\x1b[K", 3);
+            break;
+        }
     }
+#undef CELL_CHANGED
+#undef GLYPH
 }
 
 void editorRefreshScreen() {
+    struct perfSpan span = perfBegin();
     editorScroll();
-    // initialize new abuf ab
+
+    int rows = E.screenrows + 2;
+    editorFrameClear(&E.frame, 0, rows);
+    editorDrawRows();
+    editorDrawStatusBar();
+    editorDrawMessageBar();
+
+    // reuse the output arena from the last frame
+    struct abuf *ab = &E.frameBuf;
+    abReset(ab);
+
+    // hide the cursor while painting, and start from default attributes
+    abAppend(ab, "\x1b[?25l\x1b[m", 9);
+    unsigned char attr = 0;
+
+    if (!E.frameValid) {
+        abAppend(ab, "\x1b[2J", 4);
+        editorFrameClear(&E.prevFrame, 0, rows);
+        E.frameValid = 1;
+    } else {
+        editorEmitScroll(ab);
+    }
+
+    for (int y = 0; y < rows; y++) {
+        editorEmitRowDamage(ab, y, &attr);
+    }
+    if (attr != 0) {
+        abAppend(ab, "\x1b[m", 3);
+    }
+
+    editorEmitMove(ab, B->coordY - B->rowOffset, B->renderX - B->colOffset);
+    abAppend(ab, "\x1b[?25h", 6);
+
+    // the whole frame goes out in one writev, pieces still point into E.frame until then
+    ssize_t wrote = abWrite(ab, STDOUT_FILENO);
+    E.frameBytes = wrote > 0 ? wrote : 0;
+    E.totalFrameBytes += E.frameBytes;
+    E.frames++;
+    if (span.start) {
+        perfEnd("refresh", &span, E.frameBytes);
+        perfPainted();
+    }
+
+    struct screenFrame shown = E.prevFrame;
+    E.prevFrame = E.frame;
+    E.frame = shown;
+    E.frameRowOffset = B->rowOffset;
+}
+
+// BATCH
+// with -b the editor never touches the terminal: a script of edits is applied to every file
+// named, which is written back in place if anything changed. files are handed out to a pool of
+// worker threads, each with a buffer and slab arena of its own. a worker holds one file at a
+// time, its rows still in the file mapping except the ones edited, and hands its arena back
+// before taking the next, so memory per worker is bounded by the file being edited
+//
+//   s/old/new/     every occurrence of old, literally. any delimiter will do
+//   x/regex/new/   every match of regex
+//   d N[,M]        delete lines N through M
+//   i N text       insert text as a line before line N
+//   a N text       insert text as a line after line N, 0 for the top
+//
+// line numbers start from 1 and $ is the last line. they count lines as the commands before
+// have left them. blank lines and lines starting with # are skipped
+
+enum batchOp {
+    BATCH_REPLACE,
+    BATCH_REPLACE_REGEX,
+    BATCH_DELETE,
+    BATCH_INSERT,
+    BATCH_APPEND
+};
+
+struct batchCommand {
+    int op;
+    int scriptLine; // for error messages
+    char *find; // text or pattern to replace
+    int findLen;
+    char *with; // replacement, or the line inserted
+    int withLen;
+    int from, to; // line addresses, BATCH_LAST for $
+};
+
+struct batchRun {
+    struct batchCommand *cmds;
+    int ncmds;
+    char **files;
+    int nfiles;
+    pthread_mutex_t lock;
+    int next; // next file to hand out
+    int changed, failed;
+    unsigned long long bytes; // size of the files processed
+};
+
+long long batchNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// a line address at *p: a number, or $ for the last line. -1 if there is none
+int batchParseLine(char **p) {
+    if (**p == '$') {
+        (*p)++;
+        return BATCH_LAST;
+    }
+    if (!isdigit((unsigned char) **p)) {
+        return -1;
+    }
+    long line = strtol(*p, p, 10);
+    return line > INT_MAX - 1 ? -1 : (int) line;
+}
+
+// the next delimited field of an s or x command, NULL if the delimiter never comes
+char *batchParseField(char **p, char delim, int *len) {
+    char *end = strchr(*p, delim);
+    if (end == NULL) {
+        return NULL;
+    }
+    *len = end - *p;
+    char *field = strndup(*p, *len);
+    *p = end + 1;
+    return field;
+}
+
+// parse one script line into c. returns 0, or -1 with *err saying what is wrong
+int batchParseCommand(char *p, struct batchCommand *c, const char **err) {
+    memset(c, 0, sizeof(*c));
+    char op = *p++;
+    if (op == 's' || op == 'x') {
+        char delim = *p++;
+        if (delim == '\0' || delim == '\\' || isalnum((unsigned char) delim) || isspace((unsigned char) delim)) {
+            *err = "bad delimiter";
+            return -1;
+        }
+        c->op = op == 's' ? BATCH_REPLACE : BATCH_REPLACE_REGEX;
+        c->find = batchParseField(&p, delim, &c->findLen);
+        c->with = c->find ? batchParseField(&p, delim, &c->withLen) : NULL;
+        if (c->with == NULL || *p != '\0') {
+            *err = "expected s/old/new/";
+            return -1;
+        }
+        if (c->findLen == 0) {
+            *err = "nothing to replace";
+            return -1;
+        }
+        if (c->op == BATCH_REPLACE_REGEX) {
+            struct regex *re = regexCompile(c->find);
+            if (re == NULL) {
+                *err = "bad pattern";
+                return -1;
+            }
+            regexFree(re);
+        }
+        return 0;
+    }
+
+    if (op != 'd' && op != 'i' && op != 'a') {
+        *err = "unknown command";
+        return -1;
+    }
+    c->op = op == 'd' ? BATCH_DELETE : (op == 'i' ? BATCH_INSERT : BATCH_APPEND);
+    while (*p == ' ') {
+        p++;
+    }
+    c->from = c->to = batchParseLine(&p);
+    if (c->op == BATCH_DELETE && *p == ',') {
+        p++;
+        c->to = batchParseLine(&p);
+    }
+    if (c->from == -1 || c->to == -1 || (c->op != BATCH_APPEND && c->from == 0)) {
+        *err = "expected a line number";
+        return -1;
+    }
+    if (c->op == BATCH_DELETE) {
+        if (*p != '\0') {
+            *err = "expected d N[,M]";
+            return -1;
+        }
+        return 0;
+    }
+    if (*p != ' ' && *p != '\0') {
+        *err = "expected a space before the text";
+        return -1;
+    }
+    p += *p == ' ';
+    c->withLen = strlen(p);
+    c->with = strdup(p);
+    return 0;
+}
+
+int batchParse(struct batchRun *run, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int lineno = 0, cap = 0, ok = 1;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        lineno++;
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+            line[--linelen] = '\0';
+        }
+        char *p = line;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        if (run->ncmds == cap) {
+            cap = cap ? cap * 2 : 16;
+            run->cmds = realloc(run->cmds, sizeof(struct batchCommand) * cap);
+        }
+        struct batchCommand *c = &run->cmds[run->ncmds];
+        const char *err;
+        if (batchParseCommand(p, c, &err) == -1) {
+            fprintf(stderr, "%s:%d: %s\n", path, lineno, err);
+            free(c->find);
+            free(c->with);
+            ok = 0;
+            continue;
+        }
+        c->scriptLine = lineno;
+        run->ncmds++;
+    }
+    free(line);
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+// rewrite every match in the row, returning how many. a row without one is not touched, it
+// stays in the file mapping
+int batchReplaceRow(int filerow, struct batchCommand *c, struct regex *re, struct abuf *ab) {
+    erow *row = editorRowAt(filerow);
+    int from, to;
+    abReset(ab);
+    int n = editorReplaceSpan(row->chars, row->size, c->find, c->findLen, re, c->with, c->withLen, ab, &from, &to);
+    if (n > 0) {
+        editorRowReplace(filerow, from, to - from, ab->b, ab->len);
+    }
+    return n;
+}
+
+// run the script over B. returns the number of changes made, or -1 with *bad set to the
+// command whose line does not exist
+int batchApply(struct batchRun *run, struct regex **res, struct abuf *ab, struct batchCommand **bad) {
+    int changes = 0;
+    for (int k = 0; k < run->ncmds; k++) {
+        struct batchCommand *c = &run->cmds[k];
+        int from = c->from == BATCH_LAST ? B->numrows : c->from;
+        int to = c->to == BATCH_LAST ? B->numrows : c->to;
+        switch (c->op) {
+            case BATCH_REPLACE:
+            case BATCH_REPLACE_REGEX:
+                for (int r = 0; r < B->numrows; r++) {
+                    changes += batchReplaceRow(r, c, res[k], ab);
+                }
+                break;
+            case BATCH_DELETE:
+                if (from < 1 || to < from || to > B->numrows) {
+                    *bad = c;
+                    return -1;
+                }
+                for (int r = from; r <= to; r++) {
+                    editorDelRow(from - 1);
+                }
+                changes += to - from + 1;
+                break;
+            case BATCH_INSERT:
+            case BATCH_APPEND:
+                if (from > B->numrows || (c->op == BATCH_INSERT && from < 1)) {
+                    *bad = c;
+                    return -1;
+                }
+                editorAppendRow(c->op == BATCH_INSERT ? from - 1 : from, c->with, c->withLen);
+                changes++;
+                break;
+        }
+    }
+    return changes;
+}
+
+void batchFile(struct batchRun *run, char *path, struct regex **res, struct abuf *ab) {
+    long long started = batchNowUs();
+    char err[256] = "";
+    struct stat st;
+    int changes = 0;
+    if (stat(path, &st) == -1) {
+        snprintf(err, sizeof(err), "%s", strerror(errno));
+    } else if (!S_ISREG(st.st_mode)) {
+        snprintf(err, sizeof(err), "not a regular file");
+    } else {
+        B = editorBufferNew();
+        struct batchCommand *bad = NULL;
+        if (editorOpen(path) == -1) {
+            snprintf(err, sizeof(err), "%s", strerror(errno));
+        } else if (B->mixedEnds) {
+            // written back they would all end one way, a change the script never asked for
+            snprintf(err, sizeof(err), "mixed line endings, left as it is");
+        } else if ((changes = batchApply(run, res, ab, &bad)) == -1) {
+            snprintf(err, sizeof(err), "script line %d: no such line", bad->scriptLine);
+        } else if (B->mapLost) {
+            // rows past its new end read as zeros, saving would write them
+            snprintf(err, sizeof(err), "cut short while being edited, left as it is");
+        } else if (B->isDirty && editorWriteFile() == -1) {
+            snprintf(err, sizeof(err), "can't save: %s", strerror(errno));
+        }
+        editorBufferFree();
+        // the buffer's rows are all gone, so is anything that was left in the arena
+        slabReset(Slab.useMalloc);
+    }
+    double ms = (batchNowUs() - started) / 1000.0;
+
+    pthread_mutex_lock(&run->lock);
+    if (err[0]) {
+        run->failed++;
+    } else {
+        run->changed += changes > 0;
+        run->bytes += st.st_size;
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    if (err[0]) {
+        fprintf(stderr, "%s: %s\n", path, err);
+    } else {
+        printf("%s: %d changes, %lld bytes in %.2f ms, %.1f MB/s\n", path, changes,
+                (long long) st.st_size, ms, ms > 0 ? st.st_size / (ms * 1000.0) : 0.0);
+    }
+}
+
+void *batchWorker(void *arg) {
+    struct batchRun *run = arg;
     struct abuf ab = ABUF_INIT;
-    
-    abAppend(&ab, "\x1b[?251", 6);
-    
-    // reposition cursor to the top left
-    abAppend(&ab, "\x1b[H", 3);
-    abAppend(&ab, "\x1b[?25h", 6);
+    // the regex DFAs are built lazily as they run, so every worker compiles its own
+    struct regex **res = calloc(run->ncmds + 1, sizeof(struct regex *));
+    for (int k = 0; k < run->ncmds; k++) {
+        if (run->cmds[k].op == BATCH_REPLACE_REGEX) {
+            res[k] = regexCompile(run->cmds[k].find);
+        }
+    }
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+    while (1) {
+        pthread_mutex_lock(&run->lock);
+        int j = run->next++;
+        pthread_mutex_unlock(&run->lock);
+        if (j >= run->nfiles) {
+            break;
+        }
+        batchFile(run, run->files[j], res, &ab);
+    }
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.coordY - E.rowOffset) + 1, (E.renderX - E.colOffset) + 1);
-    abAppend(&ab, buf, strlen(buf));
-    
-    abAppend(&ab, "\x1b[?25h", 6);
-    // write buffer contents to stdout, then free the memory used by abuf
-    write(STDOUT_FILENO, ab.b, ab.len);
+    for (int k = 0; k < run->ncmds; k++) {
+        regexFree(res[k]);
+    }
+    free(res);
     abFree(&ab);
+    slabReset(0);
+    return NULL;
+}
+
+// apply script to files on jobs threads. returns the exit status
+int editorBatch(const char *script, int jobs, char **files, int nfiles) {
+    struct batchRun run;
+    memset(&run, 0, sizeof(run));
+    if (batchParse(&run, script) == -1) {
+        return 2;
+    }
+    run.files = files;
+    run.nfiles = nfiles;
+    pthread_mutex_init(&run.lock, NULL);
+
+    // the syntax table is loaded on first use otherwise, and workers would race to do it
+    if (E.syntax.image == NULL) {
+        char msg[1];
+        editorSyntaxLoad(NULL, msg, sizeof(msg));
+    }
+
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus < 1 ? 1 : cpus;
+    }
+    if (jobs > BATCH_MAX_THREADS) {
+        jobs = BATCH_MAX_THREADS;
+    }
+    if (jobs > nfiles) {
+        jobs = nfiles;
+    }
+
+    long long started = batchNowUs();
+    pthread_t threads[BATCH_MAX_THREADS];
+    int running = 0;
+    for (int t = 1; t < jobs; t++) {
+        if (pthread_create(&threads[running], NULL, batchWorker, &run) == 0) {
+            running++;
+        }
+    }
+    batchWorker(&run);
+    for (int t = 0; t < running; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    double secs = (batchNowUs() - started) / 1e6;
+
+    printf("%d files, %d changed, %d failed, %llu bytes in %.3f s (%.1f MB/s) on %d threads\n",
+            nfiles, run.changed, run.failed, run.bytes, secs, secs > 0 ? run.bytes / (secs * 1e6) : 0.0,
+            running + 1);
+    for (int k = 0; k < run.ncmds; k++) {
+        free(run.cmds[k].find);
+        free(run.cmds[k].with);
+    }
+    free(run.cmds);
+    pthread_mutex_destroy(&run.lock);
+    return run.failed ? 1 : 0;
 }
 
 // initialize
 
 void initEditor() {
-    E.coordX = 0; // horizontal coordinate
-    E.coordY = 0; // vertical coordinate
-    E.renderX = 0;
-    E.numrows = 0;
-    E.rowOffset = 0;
-    E.colOffset = 0;
-    E.row = NULL;
-    E.filename = NULL;
-    E.isDirty = 0;
+    E.buffers = NULL;
+    E.nbuffers = 0;
+    E.current = 0;
+    slabReset(0);
+    E.renderCache = NULL;
+    E.renderCacheSize = 0;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.syntax = NULL; // Null -> no filetype/no syntax highlight
+    E.frame.text = NULL;
+    E.frame.attr = NULL;
+    E.frame.glyphs = NULL;
+    E.prevFrame.text = NULL;
+    E.prevFrame.attr = NULL;
+    E.prevFrame.glyphs = NULL;
+    E.frameBuf = (struct abuf) ABUF_INIT;
+    searchIndexInit();
+    E.prompting = 0;
+    E.frameValid = 0;
+    E.frameRowOffset = 0;
+    E.frameBytes = 0;
+    E.totalFrameBytes = 0;
+    E.frames = 0;
 
     if (getWindowSize(&E.screenrows, &E.screencols) == -1) {
         end("getWindowSize");
     }
     E.screenrows -= 2;
+    editorRenderCacheInit(E.screenrows * RENDER_CACHE_SCREENS);
+    editorFrameInit();
+    editorBufferAdd();
 }
 
+#ifndef EDITOR_NO_MAIN
 int main(int argc, char *argv[]) {
+    // -f follows the file as it grows, -n caps the rows kept while following. -b runs a script
+    // over the files without the terminal, on -j threads. -r records the keys typed for bench.
+    // -s reads syntax definitions from another directory than ~/SYNTAX_DIR. -t writes a trace
+    // of where the time goes
+    int follow = 0, maxRows = 0, jobs = 0, opt;
+    char *script = NULL, *record = NULL, *syntaxDir = NULL, *trace = NULL;
+    while ((opt = getopt(argc, argv, "fn:b:j:r:s:t:")) != -1) {
+        if (opt == 'f') {
+            follow = 1;
+        } else if (opt == 'n' && atoi(optarg) > 0) {
+            maxRows = atoi(optarg);
+        } else if (opt == 'b') {
+            script = optarg;
+        } else if (opt == 'j' && atoi(optarg) > 0) {
+            jobs = atoi(optarg);
+        } else if (opt == 'r') {
+            record = optarg;
+        } else if (opt == 's') {
+            syntaxDir = optarg;
+        } else if (opt == 't') {
+            trace = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-s syntaxdir] [-f [-n rows]] [-r keylog] [-t trace.json] [file...]\n", argv[0]);
+            fprintf(stderr, "       %s [-s syntaxdir] -b script [-j threads] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char home[PATH_MAX], syntaxMsg[256];
+    if (syntaxDir == NULL && getenv("HOME")) {
+        snprintf(home, sizeof(home), "%s/%s", getenv("HOME"), SYNTAX_DIR);
+        syntaxDir = home;
+    }
+    int syntaxFailed = editorSyntaxLoad(syntaxDir, syntaxMsg, sizeof(syntaxMsg)) == -1;
+    editorMapGuard();
+
+    if (script) {
+        if (optind >= argc) {
+            fprintf(stderr, "%s: -b needs files to edit\n", argv[0]);
+            return 1;
+        }
+        if (syntaxFailed) {
+            fprintf(stderr, "%s\n", syntaxMsg);
+        }
+        return editorBatch(script, jobs, &argv[optind], argc - optind);
+    }
+    if (follow && optind >= argc) {
+        fprintf(stderr, "%s: -f needs a file to follow\n", argv[0]);
+        return 1;
+    }
+
+    if (record && (E.loop.record = open(record, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        perror(record);
+        return 1;
+    }
+    if (trace && perfTraceStart(trace) == -1) {
+        perror(trace);
+        return 1;
+    }
+
     enableRawMode();
     initEditor();
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    editorLoopInit();
+    // set before opening, so what the open has to say replaces it
+    editorSetStatusMessage("HELP: ^Q quit | ^S save | ^F/^R find/replace | ^Z/^Y undo | ^O/^N/^P/^W buffer");
+    if (syntaxFailed) {
+        editorSetStatusMessage("%s", syntaxMsg);
     }
-
-    editorSetStatusMessage("HELP: Ctrl-Q = quit | Ctrl-S = save | CTRL-F = find");
+    for (int j = optind; j < argc; j++) {
+        if (j > optind) {
+            editorBufferAdd();
+        }
+        B->follow.on = follow;
+        if (editorOpen(argv[j]) == -1) {
+            end("open");
+        }
+        editorSyntaxLoaded();
+        if (follow) {
+            editorFollowStart(maxRows);
+        }
+    }
+    editorBufferSwitch(0);
 
     while (1) {
-        editorRefreshScreen();
+        // keys already read are handled before the screen is drawn again
+        if (!editorKeyPending()) {
+            editorRefreshScreen();
+        }
         editorProcessKeypress();
     }
 
     return 0;
-}
\ No newline at end of file
+}
+#endif